@@ -53,72 +53,90 @@ MsgTst& MsgTst::HandleFault(EbbId id) {
 
 MsgTst::MsgTst(EbbId ebbid) : Messagable<MsgTst>(ebbid) {}
 
-std::unique_ptr<MutIOBuf> MsgTst::RandomMsg(size_t bytes) {
-  std::random_device rd;
-  std::default_random_engine rng(rd());
-  std::uniform_int_distribution<> dist(0, sizeof(alphanum) / sizeof(*alphanum) -
-                                              2);
-  std::string str;
-  str.reserve(bytes);
-  std::generate_n(std::back_inserter(str), bytes,
-                  [&]() { return alphanum[dist(rng)]; });
+std::unique_ptr<SharedIOBufRef> MsgTst::MakePayload(uint32_t size) {
+  if (size <= sizeof(Header))
+    return nullptr;
+  return IOBuf::Create<SharedIOBufRef>(
+      SharedIOBufRef::CloneView,
+      MakeUniqueIOBuf(size - sizeof(Header), /* zero_memory = */ true));
+}
 
-  auto buf = MakeUniqueIOBuf(bytes);
-  auto dp = buf->GetMutDataPointer();
-  auto i = buf->Length();
-  while (i--) {
-    auto ptr = dp.Data() + i;
-    *ptr = alphanum[dist(rng)];
-  };
+std::unique_ptr<IOBuf> MsgTst::MakeMessage(const Header& header,
+                                           const SharedIOBufRef* payload) {
+  auto buf = MakeUniqueIOBuf(sizeof(Header));
+  *reinterpret_cast<Header*>(buf->MutData()) = header;
+  if (payload) {
+    buf->PrependChain(
+        IOBuf::Create<SharedIOBufRef>(SharedIOBufRef::CloneView, *payload));
+  }
   return std::move(buf);
 }
 
-std::vector<ebbrt::Future<uint32_t>>
-MsgTst::SendMessages(Messenger::NetworkId nid, uint32_t count, size_t size) {
-  uint32_t id;
-  assert(size >= sizeof(uint32_t));
-  assert(count <= std::numeric_limits<uint32_t>::max());
+Future<uint64_t> MsgTst::Ping(Messenger::NetworkId nid, uint32_t size) {
+  kassert(size >= sizeof(Header));
+  auto call = rpc_.Start<uint64_t>();
+  auto payload = MakePayload(size);
+  SendMessage(nid, MakeMessage(Header{kPing, call.id, 0, size}, payload.get()));
+  return std::move(call.future);
+}
 
-  std::vector<ebbrt::Future<uint32_t>> ret;
-  {
-    std::lock_guard<std::mutex> guard(m_);
-    id = id_;  // Get a new id (always even)
-    id_ += 2 * count;
-  }
-  while (count--) {
-    Promise<uint32_t> promise;
-    bool inserted;
-    auto f = promise.GetFuture();
-    ret.push_back(std::move(f));
-    std::tie(std::ignore, inserted) =
-        promise_map_.emplace(id, std::move(promise));
-    assert(inserted);
-    auto buf = RandomMsg(size);
-    auto dp = buf->GetMutDataPointer();
-    dp.Get<uint32_t>() = id + 1;  // Ping messages are odd
-    id += 2;
-    SendMessage(nid, std::move(buf));
-  }
-  return ret;
+Future<uint64_t> MsgTst::Stream(Messenger::NetworkId nid, uint32_t count,
+                                uint32_t size) {
+  kassert(size >= sizeof(Header));
+  auto call = rpc_.Start<uint64_t>();
+  SendStream(nid, count, size, kStreamEnd, call.id);
+  return std::move(call.future);
+}
+
+Future<uint64_t> MsgTst::Pull(Messenger::NetworkId nid, uint32_t count,
+                              uint32_t size) {
+  kassert(size >= sizeof(Header));
+  auto call = rpc_.Start<uint64_t>();
+  SendMessage(nid, MakeMessage(Header{kPull, call.id, count, size}, nullptr));
+  return std::move(call.future);
+}
+
+// count messages of size bytes, then the message of the given type which
+// closes the run. The Messenger keeps them in order, so once the peer has the
+// last it has them all.
+void MsgTst::SendStream(Messenger::NetworkId nid, uint32_t count,
+                        uint32_t size, uint32_t type, uint32_t id) {
+  auto payload = MakePayload(size);
+  for (uint32_t i = 0; i < count; ++i)
+    SendMessage(nid, MakeMessage(Header{kStream, 0, 0, size}, payload.get()));
+  SendMessage(nid, MakeMessage(Header{type, id, count, size}, nullptr));
 }
 
 void MsgTst::ReceiveMessage(Messenger::NetworkId nid,
                             std::unique_ptr<IOBuf>&& iobuf) {
+  if (iobuf->ComputeChainDataLength() < sizeof(Header))
+    return;
+
   auto dp = iobuf->GetDataPointer();
-  auto id = dp.Get<uint32_t>();
-  // Ping messages use id + 1, so they are always odd
-  if (id & 1) {
-    // Received Ping
-    auto buf = MakeUniqueIOBuf(sizeof(uint32_t));
-    auto dp = buf->GetMutDataPointer();
-    dp.Get<uint32_t>() = id - 1;  // Send back with the original id
-    SendMessage(nid, std::move(buf));
-  } else {
-    // Received Pong, lookup in the hash table for our promise and set it
-    std::lock_guard<std::mutex> guard(m_);
-    auto it = promise_map_.find(id);
-    assert(it != promise_map_.end());
-    it->second.SetValue(id);
-    promise_map_.erase(it);
+  auto header = dp.Get<Header>();
+  switch (header.type) {
+  case kPing: {
+    // echo a message of the same size
+    auto payload = MakePayload(header.size);
+    SendMessage(nid, MakeMessage(Header{kPong, header.id, 0, header.size},
+                                 payload.get()));
+    break;
+  }
+  case kPong:
+    rpc_.Complete<uint64_t>(header.id, 2 * uint64_t(header.size));
+    break;
+  case kStream:
+    break;
+  case kStreamEnd:
+    SendMessage(nid, MakeMessage(Header{kStreamAck, header.id, header.count,
+                                        header.size},
+                                 nullptr));
+    break;
+  case kStreamAck:
+    rpc_.Complete<uint64_t>(header.id, uint64_t(header.count) * header.size);
+    break;
+  case kPull:
+    SendStream(nid, header.count, header.size, kStreamAck, header.id);
+    break;
   }
 }
@@ -5,41 +5,65 @@
 #ifndef APPS_MSGTST_SRC_MSGTST_H_
 #define APPS_MSGTST_SRC_MSGTST_H_
 
-#include <unordered_map>
-#include <iostream>
-#include <iterator>
-#include <vector>
-#include <random>
-#include <algorithm>
-
-#include <ebbrt/EbbAllocator.h>
-#include <ebbrt/UniqueIOBuf.h>
-#include <ebbrt/IOBuf.h>
+#include <cstdint>
+#include <memory>
+
+#include <ebbrt/CacheAligned.h>
+#include <ebbrt/EbbRef.h>
 #include <ebbrt/Future.h>
+#include <ebbrt/IOBuf.h>
 #include <ebbrt/Message.h>
+#include <ebbrt/Rpc.h>
+#include <ebbrt/SharedIOBufRef.h>
 
-/* The MsgTst Ebb allows both hosted and native implementations to send "PING"
- * messages via the messenger to another node (machine). The remote node
- * responds back and the initiator fulfills its Promise. */
+#include "StaticEbbIds.h"
 
-static const char alphanum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+/* The MsgTst Ebb is both ends of the Messenger benchmark. Every node answers
+ * whatever it is sent, so the native backend and a hosted process started
+ * with --serve need no driver of their own. The driving side measures:
+ *  - Ping: one message to the peer, which echoes one of the same size back
+ *  - Stream: a run of messages to the peer, acknowledged once all arrived
+ *  - Pull: asks the peer to stream a run of messages to us
+ * Each returns the number of bytes which crossed the wire. */
 
-class MsgTst : public ebbrt::Messagable<MsgTst> {
+class MsgTst : public ebbrt::CacheAligned, public ebbrt::Messagable<MsgTst> {
  public:
-  static ebbrt::EbbRef<MsgTst>
-  Create(ebbrt::EbbId id = ebbrt::ebb_allocator->Allocate());
+  // Every message starts with this, so it is the smallest message size
+  struct Header {
+    uint32_t type;
+    uint32_t id;
+    // of a stream to pull
+    uint32_t count;
+    uint32_t size;
+  };
+
+  // A static id, so the nodes agree on it without the GlobalIdMap
+  static ebbrt::EbbRef<MsgTst> Create(ebbrt::EbbId id = kMsgTstEbbId);
 
   MsgTst(ebbrt::EbbId ebbid);
-  std::unique_ptr<ebbrt::MutIOBuf> RandomMsg(size_t bytes);
   static MsgTst& HandleFault(ebbrt::EbbId id);
-  std::vector<ebbrt::Future<uint32_t>> SendMessages(ebbrt::Messenger::NetworkId nid, uint32_t count, size_t size);
+
+  ebbrt::Future<uint64_t> Ping(ebbrt::Messenger::NetworkId nid, uint32_t size);
+  ebbrt::Future<uint64_t> Stream(ebbrt::Messenger::NetworkId nid,
+                                 uint32_t count, uint32_t size);
+  ebbrt::Future<uint64_t> Pull(ebbrt::Messenger::NetworkId nid, uint32_t count,
+                               uint32_t size);
+
   void ReceiveMessage(ebbrt::Messenger::NetworkId nid,
                       std::unique_ptr<ebbrt::IOBuf>&& buffer);
 
  private:
-  std::mutex m_;
-  std::unordered_map<uint32_t, ebbrt::Promise<uint32_t>> promise_map_;
-  uint32_t id_{0};
+  enum : uint32_t { kPing, kPong, kStream, kStreamEnd, kStreamAck, kPull };
+
+  // The part of a message after the header, shared by every message of a run
+  // so that sending one costs no copy. nullptr if there is none.
+  static std::unique_ptr<ebbrt::SharedIOBufRef> MakePayload(uint32_t size);
+  static std::unique_ptr<ebbrt::IOBuf>
+  MakeMessage(const Header& header, const ebbrt::SharedIOBufRef* payload);
+  void SendStream(ebbrt::Messenger::NetworkId nid, uint32_t count,
+                  uint32_t size, uint32_t type, uint32_t id);
+
+  ebbrt::RpcTable rpc_;
 };
 
 #endif  // APPS_MSGTST_SRC_MSGTST_H_
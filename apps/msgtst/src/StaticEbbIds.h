@@ -7,6 +7,9 @@
 
 #include <ebbrt/StaticIds.h>
 
-enum : ebbrt::EbbId { kPrinterEbbId = ebbrt::kFirstStaticUserId };
+enum : ebbrt::EbbId {
+  kPrinterEbbId = ebbrt::kFirstStaticUserId,
+  kMsgTstEbbId
+};
 
 #endif  // APPS_MSGTST_SRC_STATICEBBIDS_H_
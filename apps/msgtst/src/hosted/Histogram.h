@@ -0,0 +1,89 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef APPS_MSGTST_SRC_HOSTED_HISTOGRAM_H_
+#define APPS_MSGTST_SRC_HOSTED_HISTOGRAM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Counts samples in log-linear buckets: each value below 2^kSubBits has a
+// bucket of its own, and above that every power of two is split into
+// 2^kSubBits buckets. A bucket is thus within 1/2^kSubBits of the values in
+// it, whatever their magnitude, and the histogram stays small.
+class Histogram {
+ public:
+  static const constexpr unsigned kSubBits = 5;
+
+  void Record(uint64_t value) {
+    auto i = Index(value);
+    if (i >= counts_.size())
+      counts_.resize(i + 1);
+    ++counts_[i];
+    ++count_;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  uint64_t Count() const { return count_; }
+  uint64_t Min() const { return count_ ? min_ : 0; }
+  uint64_t Max() const { return max_; }
+  double Mean() const {
+    return count_ ? static_cast<double>(sum_) / count_ : 0;
+  }
+
+  // The upper end of the bucket holding the p'th percentile
+  uint64_t Percentile(double p) const {
+    auto rank = std::max<uint64_t>(std::ceil(p / 100 * count_), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank)
+        return std::min(Upper(i), max_);
+    }
+    return max_;
+  }
+
+  // f(lower, upper, count) for each bucket with samples, both ends inclusive
+  template <typename F> void ForEachBucket(F f) const {
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      if (counts_[i])
+        f(Lower(i), Upper(i), counts_[i]);
+    }
+  }
+
+ private:
+  static const constexpr uint64_t kSubBuckets = 1 << kSubBits;
+
+  static size_t Index(uint64_t value) {
+    if (value < kSubBuckets)
+      return value;
+    unsigned shift = 63 - __builtin_clzll(value) - kSubBits;
+    return ((shift + 1) << kSubBits) + ((value >> shift) & (kSubBuckets - 1));
+  }
+
+  static uint64_t Lower(size_t i) {
+    if (i < kSubBuckets)
+      return i;
+    return (kSubBuckets + i % kSubBuckets) << (i / kSubBuckets - 1);
+  }
+
+  static uint64_t Upper(size_t i) {
+    if (i < kSubBuckets)
+      return i;
+    return Lower(i) + (uint64_t(1) << (i / kSubBuckets - 1)) - 1;
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_{0};
+  uint64_t sum_{0};
+  uint64_t min_{std::numeric_limits<uint64_t>::max()};
+  uint64_t max_{0};
+};
+
+#endif  // APPS_MSGTST_SRC_HOSTED_HISTOGRAM_H_
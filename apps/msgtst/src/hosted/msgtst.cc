@@ -3,83 +3,369 @@
 //    (See accompanying file LICENSE_1_0.txt or copy at
 //          http://www.boost.org/LICENSE_1_0.txt)
 
-/* Messenger Test
- * Send fixed-size messages from the front-end to back-end and wait for
- * acks from back-end.
+/* Messenger Benchmark
+ * For each message size, measures
+ *   latency  round trips to the first peer, one at a time
+ *   stream   a run of messages to the first peer
+ *   fanin    every peer streaming a run to us at once
+ *   percore  every core streaming a run to the first peer at once
+ * and prints one record per result, as JSON lines or CSV.
  *
- * Usage:
- * ./msgtst <msg_size [B]> <msg_count>
+ * Against native backends, booted by the node allocator (e.g. under QEMU):
+ * ./msgtst [--nodes <n>] [options]
  *
+ * Against hosted processes, started with --serve. To run them on one host,
+ * pin each to its own loopback address on a common port:
+ * EBBRT_MESSENGER_ADDRESS=127.0.0.2 EBBRT_MESSENGER_PORT=9000 ./msgtst --serve
+ * EBBRT_MESSENGER_ADDRESS=127.0.0.1 EBBRT_MESSENGER_PORT=9000 \
+ *   ./msgtst --peer 127.0.0.2 [--peer <ip> ...] [options]
+ *
+ * Options:
+ *   --sizes <bytes,...>  message sizes, at least 16 (default 64,1024,65536)
+ *   --count <n>          messages per run and round trips (default 10000)
+ *   --cores <n>          cores of this process, the percore senders
+ *   --format json|csv    (default json)
+ *   --tcp                do not use shared memory with peers on this host
  * */
-#include <signal.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
+#include <ebbrt/Cpu.h>
+#include <ebbrt/EventManager.h>
 #include <ebbrt/Future.h>
-#include <ebbrt/GlobalIdMap.h>
-#include <ebbrt/Runtime.h>
-#include <ebbrt/StaticIds.h>
-#include <ebbrt/hosted/Context.h>
-#include <ebbrt/hosted/ContextActivation.h>
 #include <ebbrt/hosted/NodeAllocator.h>
 
 #include "../MsgTst.h"
+#include "Histogram.h"
 
 using namespace ebbrt;
 
-int main(int argc, char** argv) {
-  auto bindir = boost::filesystem::system_complete(argv[0]).parent_path() /
-                "/bm/msgtst.elf32";
-
-  ebbrt::Runtime runtime;
-  ebbrt::Context c(runtime);
-  boost::asio::signal_set sig(c.io_service_, SIGINT);
-  {
-    ebbrt::ContextActivation activation(c);
-
-    uint32_t msg_size;
-    uint32_t msg_count;
-    if (argc == 1) {
-      // prompt user for size/amount
-      std::cout << "Message size (bytes): ";
-      std::cin >> msg_size;
-      std::cout << "Message count: ";
-      std::cin >> msg_count;
-    } else if (argc == 2) {
-      // default amount to 1
-      msg_size = std::stoi(argv[1]);
-      msg_count = 1;
+namespace {
+struct Options {
+  std::string exec;
+  bool serve{false};
+  bool tcp{false};
+  bool csv{false};
+  size_t nodes{1};
+  size_t cores{1};
+  uint32_t count{10000};
+  std::vector<uint32_t> sizes{64, 1024, 65536};
+  std::vector<std::string> peers;
+};
+
+Options opts;
+
+// round trips made before the measured ones, to set up connections
+const constexpr uint32_t kWarmup = 100;
+
+typedef std::shared_ptr<const std::vector<Messenger::NetworkId>> Peers;
+typedef std::chrono::steady_clock BenchClock;
+
+double Since(BenchClock::time_point start) {
+  return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+struct Result {
+  const char* bench;
+  uint32_t size;
+  // nodes or cores sending at once
+  size_t senders;
+  uint64_t messages;
+  uint64_t bytes;
+  double seconds;
+  const Histogram* latency;
+};
+
+void Print(const Result& r) {
+  auto target = opts.peers.empty() ? "native" : "hosted";
+  auto rate = r.seconds > 0 ? r.messages / r.seconds : 0;
+  auto mbps = r.seconds > 0 ? r.bytes / r.seconds / 1e6 : 0;
+  std::ostringstream out;
+  if (opts.csv) {
+    static bool header = false;
+    if (!header) {
+      std::cout << "bench,target,shm,size,senders,messages,bytes,seconds,"
+                   "msgs_per_sec,mb_per_sec,min_ns,mean_ns,p50_ns,p99_ns,"
+                   "p999_ns,max_ns" << std::endl;
+      header = true;
+    }
+    out << r.bench << "," << target << "," << !opts.tcp << "," << r.size
+        << "," << r.senders << "," << r.messages << "," << r.bytes << ","
+        << r.seconds << "," << rate << "," << mbps;
+    if (r.latency) {
+      auto& h = *r.latency;
+      out << "," << h.Min() << "," << h.Mean() << "," << h.Percentile(50)
+          << "," << h.Percentile(99) << "," << h.Percentile(99.9) << ","
+          << h.Max();
     } else {
-      msg_size = std::stoi(argv[1]);
-      msg_count = std::stoi(argv[2]);
+      out << ",,,,,,";
     }
+  } else {
+    out << "{\"bench\":\"" << r.bench << "\",\"target\":\"" << target
+        << "\",\"shm\":" << (opts.tcp ? "false" : "true")
+        << ",\"size\":" << r.size << ",\"senders\":" << r.senders
+        << ",\"messages\":" << r.messages << ",\"bytes\":" << r.bytes
+        << ",\"seconds\":" << r.seconds << ",\"msgs_per_sec\":" << rate
+        << ",\"mb_per_sec\":" << mbps;
+    if (r.latency) {
+      auto& h = *r.latency;
+      out << ",\"latency_ns\":{\"min\":" << h.Min() << ",\"mean\":"
+          << h.Mean() << ",\"p50\":" << h.Percentile(50)
+          << ",\"p99\":" << h.Percentile(99)
+          << ",\"p999\":" << h.Percentile(99.9) << ",\"max\":" << h.Max()
+          << ",\"histogram\":[";
+      auto first = true;
+      h.ForEachBucket([&](uint64_t lower, uint64_t upper, uint64_t count) {
+        out << (first ? "" : ",") << "[" << lower << "," << upper << ","
+            << count << "]";
+        first = false;
+      });
+      out << "]}";
+    }
+    out << "}";
+  }
+  std::cout << out.str() << std::endl;
+}
 
-    if (!msg_size || !msg_count)
-      exit(0);
-    // ensure clean quit on ctrl-c
-    sig.async_wait([&c](const boost::system::error_code& ec,
-                        int signal_number) { c.io_service_.stop(); });
-
-    try {
-      auto node_desc = node_allocator->AllocateNode(bindir.string());
-      node_desc.NetworkId().Then([msg_size, msg_count](auto f) {
-        auto nid = f.Get();
-        auto msgtst_ebb = MsgTst::Create();
-        if (msg_size > 0) {
-          std::cout << "Sending " << msg_count << " " << msg_size
-                    << "B messages..." << std::endl;
-          auto fs = msgtst_ebb->SendMessages(nid, msg_count, msg_size);
-          WhenAll(fs.begin(), fs.end()).Then([=](auto f) {
-            std::cout << "Messages sent successfully!" << std::endl;
-          });
+// Round trips are made one at a time, each one starts the next
+struct LatencyRun {
+  Messenger::NetworkId nid;
+  uint32_t size;
+  uint32_t warmup;
+  uint32_t left;
+  uint64_t bytes{0};
+  Histogram latency;
+  Promise<void> done;
+};
+
+void PingNext(std::shared_ptr<LatencyRun> run) {
+  if (!run->left) {
+    run->done.SetValue();
+    return;
+  }
+  auto start = BenchClock::now();
+  MsgTst::Create()
+      ->Ping(run->nid, run->size)
+      .Then([run, start](Future<uint64_t> f) {
+        auto bytes = f.Get();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      BenchClock::now() - start)
+                      .count();
+        if (run->warmup) {
+          --run->warmup;
+        } else {
+          run->latency.Record(ns);
+          run->bytes += bytes;
+          --run->left;
         }
-        return;
+        PingNext(run);
+      });
+}
+
+Future<void> Latency(Peers peers, uint32_t size) {
+  auto run = std::make_shared<LatencyRun>();
+  run->nid = peers->front();
+  run->size = size;
+  run->warmup = kWarmup;
+  run->left = opts.count;
+  auto ret = run->done.GetFuture();
+  auto start = BenchClock::now();
+  PingNext(run);
+  return ret.Then([run, start, size](Future<void> f) {
+    f.Get();
+    Print(Result{"latency", size, 1, 2 * uint64_t(opts.count), run->bytes,
+                 Since(start), &run->latency});
+  });
+}
+
+// Collects the runs of several senders into one result
+Future<void> Report(const char* bench, uint32_t size,
+                    std::vector<Future<uint64_t>> runs,
+                    BenchClock::time_point start) {
+  auto senders = runs.size();
+  return WhenAll(runs.begin(), runs.end())
+      .Then([=](Future<std::vector<uint64_t>> f) {
+        uint64_t bytes = 0;
+        for (auto b : f.Get())
+          bytes += b;
+        Print(Result{bench, size, senders, senders * opts.count, bytes,
+                     Since(start), nullptr});
       });
-    } catch (std::runtime_error& e) {
-      std::cout << e.what() << std::endl;
-      exit(1);
+}
+
+Future<void> Stream(Peers peers, uint32_t size) {
+  auto start = BenchClock::now();
+  std::vector<Future<uint64_t>> runs;
+  runs.emplace_back(MsgTst::Create()->Stream(peers->front(), opts.count, size));
+  return Report("stream", size, std::move(runs), start);
+}
+
+Future<void> FanIn(Peers peers, uint32_t size) {
+  auto start = BenchClock::now();
+  std::vector<Future<uint64_t>> runs;
+  for (auto& nid : *peers)
+    runs.emplace_back(MsgTst::Create()->Pull(nid, opts.count, size));
+  return Report("fanin", size, std::move(runs), start);
+}
+
+Future<void> PerCore(Peers peers, uint32_t size) {
+  auto start = BenchClock::now();
+  std::vector<Future<uint64_t>> runs;
+  for (size_t core = 0; core < Cpu::Count(); ++core) {
+    auto promise = std::make_shared<Promise<uint64_t>>();
+    runs.emplace_back(promise->GetFuture());
+    event_manager->SpawnRemote(
+        [peers, size, promise]() {
+          MsgTst::Create()
+              ->Stream(peers->front(), opts.count, size)
+              .Then([promise](Future<uint64_t> f) {
+                try {
+                  promise->SetValue(f.Get());
+                } catch (...) {
+                  promise->SetException(std::current_exception());
+                }
+              });
+        },
+        Cpu::GetByIndex(core)->get_context());
+  }
+  return Report("percore", size, std::move(runs), start);
+}
+
+Future<void> RunSizes(Peers peers, size_t i) {
+  if (i == opts.sizes.size())
+    return MakeReadyFuture<void>();
+
+  auto size = opts.sizes[i];
+  return Latency(peers, size)
+      .Then([peers, size](Future<void> f) {
+        f.Get();
+        return Stream(peers, size);
+      })
+      .Then([peers, size](Future<void> f) {
+        f.Get();
+        return FanIn(peers, size);
+      })
+      .Then([peers, size](Future<void> f) {
+        f.Get();
+        return PerCore(peers, size);
+      })
+      .Then([peers, i](Future<void> f) {
+        f.Get();
+        return RunSizes(peers, i + 1);
+      });
+}
+
+Future<std::vector<Messenger::NetworkId>> GetPeers() {
+  std::vector<Future<Messenger::NetworkId>> nids;
+  if (opts.peers.empty()) {
+    auto bindir = boost::filesystem::system_complete(opts.exec).parent_path() /
+                  "/bm/msgtst.elf32";
+    for (size_t i = 0; i < opts.nodes; ++i) {
+      auto node = node_allocator->AllocateNode(bindir.string());
+      nids.emplace_back(std::move(node.NetworkId()));
+    }
+  } else {
+    for (auto& peer : opts.peers) {
+      nids.emplace_back(MakeReadyFuture<Messenger::NetworkId>(
+          boost::asio::ip::address_v4::from_string(peer)));
+    }
+  }
+  return WhenAll(nids.begin(), nids.end());
+}
+
+void Usage() {
+  std::cerr << "usage: msgtst [--serve] [--peer <ip>]... [--nodes <n>] "
+               "[--sizes <bytes,...>] [--count <n>] [--cores <n>] "
+               "[--format json|csv] [--tcp]" << std::endl;
+  exit(1);
+}
+
+void ParseArgs(int argc, char** argv) {
+  opts.exec = argv[0];
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (++i == argc)
+        Usage();
+      return argv[i];
+    };
+    if (arg == "--serve") {
+      opts.serve = true;
+    } else if (arg == "--tcp") {
+      opts.tcp = true;
+    } else if (arg == "--peer") {
+      opts.peers.emplace_back(value());
+    } else if (arg == "--nodes") {
+      opts.nodes = std::stoul(value());
+    } else if (arg == "--cores") {
+      opts.cores = std::stoul(value());
+    } else if (arg == "--count") {
+      opts.count = std::stoul(value());
+    } else if (arg == "--format") {
+      auto format = value();
+      if (format != "json" && format != "csv")
+        Usage();
+      opts.csv = format == "csv";
+    } else if (arg == "--sizes") {
+      opts.sizes.clear();
+      std::istringstream sizes(value());
+      std::string size;
+      while (std::getline(sizes, size, ','))
+        opts.sizes.push_back(std::stoul(size));
+    } else {
+      Usage();
     }
   }
-  c.Run();
+  for (auto size : opts.sizes) {
+    if (size < sizeof(MsgTst::Header))
+      Usage();
+  }
+  if (!opts.count || !opts.nodes || !opts.cores || opts.sizes.empty())
+    Usage();
+}
+}  // namespace
+
+void AppMain() {
+  messenger->SetSharedMemory(!opts.tcp);
+  if (opts.serve) {
+    // answering is left to MsgTst, just start listening
+    std::cerr << "msgtst: serving on port " << messenger->GetPort()
+              << std::endl;
+    return;
+  }
+
+  GetPeers()
+      .Then([](Future<std::vector<Messenger::NetworkId>> f) {
+        auto peers = std::make_shared<const std::vector<Messenger::NetworkId>>(
+            std::move(f.Get()));
+        return RunSizes(std::move(peers), 0);
+      })
+      .Then([](Future<void> f) {
+        auto ret = 0;
+        try {
+          f.Get();
+        } catch (std::exception& e) {
+          std::cerr << "msgtst: " << e.what() << std::endl;
+          ret = 1;
+        }
+        if (opts.peers.empty())
+          node_allocator->FreeAllNodes();
+        Cpu::Exit(ret);
+      });
+}
+
+int main(int argc, char** argv) {
+  void* status;
+
+  ParseArgs(argc, argv);
+  pthread_t tid = Cpu::EarlyInit(opts.cores);
+  pthread_join(tid, &status);
   return 0;
 }
@@ -0,0 +1,84 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Measures the cost of descriptor lookups and of open/close churn on the Vfs
+// descriptor table, with every core running the same loop at once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include <ebbrt/Debug.h>
+#include <ebbrt/EventManager.h>
+#include <ebbrt/native/Clock.h>
+#include <ebbrt/native/Cpu.h>
+#include <ebbrt-socket/SocketManager.h>
+#include <ebbrt-socket/Vfs.h>
+
+namespace {
+const constexpr size_t kDescriptors = 1024;
+const constexpr size_t kLookupIterations = 10000000;
+const constexpr size_t kChurnIterations = 1000000;
+
+std::vector<int> fds;
+std::atomic<size_t> arrived{0};
+std::atomic<size_t> finished{0};
+std::atomic<uint64_t> lookup_ns{0};
+std::atomic<uint64_t> churn_ns{0};
+
+// Wait for every core to get here so the measured loops overlap
+void Barrier(std::atomic<size_t>& counter, size_t generation) {
+  counter.fetch_add(1);
+  while (counter.load() < generation * ebbrt::Cpu::Count()) {
+  }
+}
+
+uint64_t ElapsedNs(ebbrt::clock::Wall::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             ebbrt::clock::Wall::Now() - start)
+      .count();
+}
+
+void Worker(ebbrt::EbbRef<ebbrt::Vfs::Fd> ref) {
+  Barrier(arrived, 1);
+  auto start = ebbrt::clock::Wall::Now();
+  size_t sum = 0;
+  for (size_t i = 0; i < kLookupIterations; ++i) {
+    auto fd = ebbrt::root_vfs->Lookup(fds[i % kDescriptors]);
+    sum += static_cast<ebbrt::EbbId>(fd);
+  }
+  lookup_ns.fetch_add(ElapsedNs(start));
+
+  Barrier(arrived, 2);
+  start = ebbrt::clock::Wall::Now();
+  for (size_t i = 0; i < kChurnIterations; ++i) {
+    auto fd = ebbrt::root_vfs->RegisterFd(ref);
+    ebbrt::root_vfs->UnregisterFd(fd);
+  }
+  churn_ns.fetch_add(ElapsedNs(start));
+
+  if (finished.fetch_add(1) + 1 == ebbrt::Cpu::Count()) {
+    auto cores = ebbrt::Cpu::Count();
+    ebbrt::kprintf(
+        "vfsbench cores=%d lookup_ns=%llu churn_ns=%llu (checksum %llu)\n",
+        static_cast<int>(cores),
+        static_cast<unsigned long long>(lookup_ns.load() /  // NOLINT
+                                        (cores * kLookupIterations)),
+        static_cast<unsigned long long>(churn_ns.load() /  // NOLINT
+                                        (cores * kChurnIterations)),
+        static_cast<unsigned long long>(sum));  // NOLINT
+  }
+}
+}  // namespace
+
+void AppMain() {
+  auto ref = ebbrt::SocketManager::SocketFd::Create();
+  for (size_t i = 0; i < kDescriptors; ++i)
+    fds.push_back(ebbrt::root_vfs->RegisterFd(ref));
+
+  for (size_t core = 0; core < ebbrt::Cpu::Count(); ++core) {
+    ebbrt::event_manager->SpawnRemote([ref]() { Worker(ref); }, core);
+  }
+}
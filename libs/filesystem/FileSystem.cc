@@ -18,8 +18,7 @@
 EBBRT_PUBLISH_TYPE(, FileSystem);
 
 FileSystem::FileSystem(ebbrt::EbbId id, ebbrt::Messenger::NetworkId frontend_id)
-    : ebbrt::Messagable<FileSystem>(id), frontend_id_(frontend_id),
-      request_(0) {}
+    : ebbrt::Messagable<FileSystem>(id), frontend_id_(frontend_id) {}
 
 namespace {
 class StringOutputStream : public kj::OutputStream {
@@ -69,100 +68,82 @@ FileSystem &FileSystem::CreateRep(ebbrt::EbbId id) {
 void FileSystem::DestroyRep(ebbrt::EbbId id, FileSystem &rep) { delete &rep; }
 
 ebbrt::Future<FileSystem::StatInfo> FileSystem::Stat(const char *path) {
-  lock_.lock();
-  auto v = request_++;
-  auto &p = stat_promises_[v];
-  lock_.unlock();
+  auto call = rpc_.Start<StatInfo>();
   ebbrt::IOBufMessageBuilder message;
   auto builder = message.initRoot<filesystem::Message>();
   auto request_builder = builder.initRequest();
   auto stat_builder = request_builder.initStatRequest();
-  stat_builder.setId(v);
+  stat_builder.setId(call.id);
   auto file_builder = stat_builder.initFile();
   file_builder.setPath(capnp::Text::Reader(path));
   SendMessage(frontend_id_, ebbrt::AppendHeader(message));
-  return p.GetFuture();
+  return std::move(call.future);
 }
 
 ebbrt::Future<FileSystem::StatInfo> FileSystem::LStat(const char *path) {
-  lock_.lock();
-  auto v = request_++;
-  auto &p = stat_promises_[v];
-  lock_.unlock();
+  auto call = rpc_.Start<StatInfo>();
   ebbrt::IOBufMessageBuilder message;
   auto builder = message.initRoot<filesystem::Message>();
   auto request_builder = builder.initRequest();
   auto stat_builder = request_builder.initStatRequest();
-  stat_builder.setId(v);
+  stat_builder.setId(call.id);
   auto file_builder = stat_builder.initFile();
   file_builder.setLpath(capnp::Text::Reader(path));
   SendMessage(frontend_id_, ebbrt::AppendHeader(message));
-  return p.GetFuture();
+  return std::move(call.future);
 }
 
 ebbrt::Future<FileSystem::StatInfo> FileSystem::FStat(int fd) {
-  lock_.lock();
-  auto v = request_++;
-  auto &p = stat_promises_[v];
-  lock_.unlock();
+  auto call = rpc_.Start<StatInfo>();
   ebbrt::IOBufMessageBuilder message;
   auto builder = message.initRoot<filesystem::Message>();
   auto request_builder = builder.initRequest();
   auto stat_builder = request_builder.initStatRequest();
-  stat_builder.setId(v);
+  stat_builder.setId(call.id);
   auto file_builder = stat_builder.initFile();
   file_builder.setFd(fd);
   SendMessage(frontend_id_, ebbrt::AppendHeader(message));
-  return p.GetFuture();
+  return std::move(call.future);
 }
 
 ebbrt::Future<std::string> FileSystem::GetCwd() {
-  lock_.lock();
-  auto v = request_++;
-  auto &p = string_promises_[v];
-  lock_.unlock();
+  auto call = rpc_.Start<std::string>();
   ebbrt::IOBufMessageBuilder message;
   auto builder = message.initRoot<filesystem::Message>();
   auto request_builder = builder.initRequest();
   auto get_cwd_builder = request_builder.initGetCwdRequest();
-  get_cwd_builder.setId(v);
+  get_cwd_builder.setId(call.id);
   SendMessage(frontend_id_, ebbrt::AppendHeader(message));
-  return p.GetFuture();
+  return std::move(call.future);
 }
 
 ebbrt::Future<int> FileSystem::Open(const char *path, int flags, int mode) {
-  lock_.lock();
-  auto v = request_++;
-  auto &p = open_promises_[v];
-  lock_.unlock();
+  auto call = rpc_.Start<int>();
   ebbrt::IOBufMessageBuilder message;
   auto builder = message.initRoot<filesystem::Message>();
   auto request_builder = builder.initRequest();
   auto open_builder = request_builder.initOpenRequest();
-  open_builder.setId(v);
+  open_builder.setId(call.id);
   open_builder.setPath(capnp::Text::Reader(path));
   open_builder.setFlags(flags);
   open_builder.setMode(mode);
   SendMessage(frontend_id_, ebbrt::AppendHeader(message));
-  return p.GetFuture();
+  return std::move(call.future);
 }
 
 ebbrt::Future<std::string> FileSystem::Read(int fd, size_t length,
                                             int64_t offset) {
-  lock_.lock();
-  auto v = request_++;
-  auto &p = string_promises_[v];
-  lock_.unlock();
+  auto call = rpc_.Start<std::string>();
   ebbrt::IOBufMessageBuilder message;
   auto builder = message.initRoot<filesystem::Message>();
   auto request_builder = builder.initRequest();
   auto read_builder = request_builder.initReadRequest();
-  read_builder.setId(v);
+  read_builder.setId(call.id);
   read_builder.setFd(fd);
   read_builder.setLength(length);
   read_builder.setOffset(offset);
   SendMessage(frontend_id_, ebbrt::AppendHeader(message));
-  return p.GetFuture();
+  return std::move(call.future);
 }
 
 void FileSystem::ReceiveMessage(ebbrt::Messenger::NetworkId nid,
@@ -297,54 +278,27 @@ void FileSystem::ReceiveMessage(ebbrt::Messenger::NetworkId nid,
       sinfo.stat_atime = stat_reply.getAtime();
       sinfo.stat_mtime = stat_reply.getMtime();
       sinfo.stat_ctime = stat_reply.getCtime();
-      auto id = stat_reply.getId();
-      lock_.lock();
-      auto it = stat_promises_.find(id);
-      assert(it != stat_promises_.end());
-      auto p = std::move(it->second);
-      stat_promises_.erase(it);
-      lock_.unlock();
-      p.SetValue(sinfo);
+      rpc_.Complete<StatInfo>(stat_reply.getId(), sinfo);
       break;
     }
     case filesystem::Reply::Which::GET_CWD_REPLY: {
       auto get_cwd_reply = reply.getGetCwdReply();
-      auto id = get_cwd_reply.getId();
-      lock_.lock();
-      auto it = string_promises_.find(id);
-      assert(it != string_promises_.end());
-      auto p = std::move(it->second);
-      string_promises_.erase(it);
-      lock_.unlock();
-      p.SetValue(std::string(get_cwd_reply.getCwd().cStr()));
+      rpc_.Complete<std::string>(get_cwd_reply.getId(),
+                                 std::string(get_cwd_reply.getCwd().cStr()));
       break;
     }
     case filesystem::Reply::Which::OPEN_REPLY: {
       auto open_reply = reply.getOpenReply();
-      auto id = open_reply.getId();
-      lock_.lock();
-      auto it = open_promises_.find(id);
-      assert(it != open_promises_.end());
-      auto p = std::move(it->second);
-      open_promises_.erase(it);
-      lock_.unlock();
-      p.SetValue(open_reply.getFd());
+      rpc_.Complete<int>(open_reply.getId(), open_reply.getFd());
       break;
     }
     case filesystem::Reply::Which::READ_REPLY: {
       auto read_reply = reply.getReadReply();
-      auto id = read_reply.getId();
       auto data_reader = read_reply.getData();
       auto str =
           std::string(reinterpret_cast<const char *>(data_reader.begin()),
                       data_reader.size());
-      lock_.lock();
-      auto it = string_promises_.find(id);
-      assert(it != string_promises_.end());
-      auto p = std::move(it->second);
-      string_promises_.erase(it);
-      lock_.unlock();
-      p.SetValue(std::move(str));
+      rpc_.Complete<std::string>(read_reply.getId(), std::move(str));
       break;
     }
     }
@@ -6,6 +6,7 @@
 #define FILESYSTEM_H_
 
 #include <ebbrt/Message.h>
+#include <ebbrt/Rpc.h>
 #include <ebbrt/SharedEbb.h>
 
 class FileSystem : public ebbrt::SharedEbb<FileSystem>,
@@ -42,11 +43,7 @@ private:
                       std::unique_ptr<ebbrt::IOBuf> &&buffer);
 
   ebbrt::Messenger::NetworkId frontend_id_;
-  std::mutex lock_;
-  uint32_t request_;
-  std::unordered_map<uint32_t, ebbrt::Promise<StatInfo> > stat_promises_;
-  std::unordered_map<uint32_t, ebbrt::Promise<std::string> > string_promises_;
-  std::unordered_map<uint32_t, ebbrt::Promise<int> > open_promises_;
+  ebbrt::RpcTable rpc_;
 
   friend ebbrt::Messagable<FileSystem>;
 };
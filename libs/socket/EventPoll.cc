@@ -0,0 +1,218 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "EventPoll.h"
+#include <ebbrt/Debug.h>
+
+#include <errno.h>
+#include <poll.h>
+
+namespace {
+// Conditions which are always reported, regardless of the interest mask
+const constexpr uint32_t kAlwaysReported = POLLERR | POLLHUP;
+}
+
+ebbrt::EventPoll::~EventPoll() {
+  for (auto& kv : watches_) {
+    kv.second->fd_->RemoveWatcher(*kv.second);
+  }
+  ready_.clear();
+}
+
+void ebbrt::EventPoll::Watch::ReadinessChanged() { poll_.Signal(*this); }
+
+void ebbrt::EventPoll::Watch::Detached() { poll_.Forget(*this); }
+
+// Invoked on the core where a watched descriptor changed readiness
+void ebbrt::EventPoll::Signal(Watch& w) {
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(lock_);
+    if (!w.enabled_)
+      return;
+    if (!w.ready_hook_.is_linked())
+      ready_.push_back(w);
+    if (waiting_) {
+      waiting_ = false;
+      waiter_.SetValue();
+    }
+  }
+  // An EventPoll may itself be watched
+  NotifyWatchers();
+}
+
+// The watched descriptor was closed, drop it from the interest set unless a
+// concurrent Remove got there first (and will free the watch itself)
+void ebbrt::EventPoll::Forget(Watch& w) {
+  // declared first so the watch is freed after the lock is released
+  std::unique_ptr<Watch> watch;
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  auto it = watches_.find(w.fd_int_);
+  if (it == watches_.end() || it->second.get() != &w)
+    return;
+  watch = std::move(it->second);
+  watches_.erase(it);
+  if (w.ready_hook_.is_linked())
+    ready_.erase(ready_.iterator_to(w));
+}
+
+int ebbrt::EventPoll::Add(int fd, uint32_t events, uint64_t data) {
+  EbbRef<Vfs::Fd> ref;
+  try {
+    ref = root_vfs->Lookup(fd);
+  } catch (std::invalid_argument& e) {
+    return EBADF;
+  }
+  if (static_cast<Vfs::Fd*>(&*ref) == this)
+    return EINVAL;
+
+  Watch* w;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(lock_);
+    if (watches_.find(fd) != watches_.end())
+      return EEXIST;
+    auto watch = std::make_unique<Watch>(*this, fd, ref, events, data);
+    w = watch.get();
+    watches_.emplace(fd, std::move(watch));
+  }
+  ref->AddWatcher(*w);
+  // The descriptor may already be ready, in which case no change will be
+  // signalled
+  if (ref->Readiness() & (events | kAlwaysReported))
+    Signal(*w);
+  return 0;
+}
+
+int ebbrt::EventPoll::Modify(int fd, uint32_t events, uint64_t data) {
+  Watch* w;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(lock_);
+    auto it = watches_.find(fd);
+    if (it == watches_.end())
+      return ENOENT;
+    w = it->second.get();
+    w->events_ = events;
+    w->data_ = data;
+    w->enabled_ = true;
+  }
+  if (w->fd_->Readiness() & (events | kAlwaysReported))
+    Signal(*w);
+  return 0;
+}
+
+int ebbrt::EventPoll::Remove(int fd) {
+  std::unique_ptr<Watch> w;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(lock_);
+    auto it = watches_.find(fd);
+    if (it == watches_.end())
+      return ENOENT;
+    w = std::move(it->second);
+    watches_.erase(it);
+  }
+  // Once removed from the descriptor no further signals can arrive, then it
+  // is safe to unlink the watch from the ready list
+  w->fd_->RemoveWatcher(*w);
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  if (w->ready_hook_.is_linked())
+    ready_.erase(ready_.iterator_to(*w));
+  return 0;
+}
+
+// Harvest events from the ready list, must be called with lock_ held.
+// Edge triggered and one shot watches leave the list once reported, level
+// triggered watches stay on it (moved to the back, so that a small
+// max_events does not starve later descriptors) for as long as they remain
+// ready.
+int ebbrt::EventPoll::Collect(Event* events, int max_events) {
+  int n = 0;
+  ReadyList requeue;
+  while (!ready_.empty() && n < max_events) {
+    auto& w = ready_.front();
+    ready_.pop_front();
+    if (!w.enabled_)
+      continue;
+    auto revents = w.fd_->Readiness() & (w.events_ | kAlwaysReported);
+    if (!revents)
+      continue;
+    events[n].events = revents;
+    events[n].data = w.data_;
+    ++n;
+    if (w.events_ & kOneShot) {
+      w.enabled_ = false;
+    } else if (!(w.events_ & kEdgeTriggered)) {
+      requeue.push_back(w);
+    }
+  }
+  ready_.splice(ready_.end(), requeue);
+  return n;
+}
+
+int ebbrt::EventPoll::Wait(Event* events, int max_events, int timeout) {
+  kassert(max_events > 0);
+  bool timer_set = false;
+  int n;
+  while (true) {
+    Future<void> wake;
+    {
+      std::lock_guard<ebbrt::SpinLock> guard(lock_);
+      n = Collect(events, max_events);
+      if (n > 0 || timeout == 0 || timed_out_)
+        break;
+      kbugon(waiting_, "EventPoll waited on concurrently\n");
+      waiter_ = Promise<void>();
+      wake = waiter_.GetFuture();
+      waiting_ = true;
+    }
+    if (timeout > 0 && !timer_set) {
+      timer->Start(*this, std::chrono::milliseconds(timeout),
+                   /* repeat = */ false);
+      timer_set = true;
+    }
+    wake.Block();
+  }
+  if (timer_set && !timed_out_)
+    timer->Stop(*this);
+  timed_out_ = false;
+  return n;
+}
+
+// Wait timeout, runs on the core of the waiter
+void ebbrt::EventPoll::Fire() {
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  timed_out_ = true;
+  if (waiting_) {
+    waiting_ = false;
+    waiter_.SetValue();
+  }
+}
+
+uint32_t ebbrt::EventPoll::Readiness() {
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  return ready_.empty() ? 0 : POLLIN;
+}
+
+ebbrt::Future<std::unique_ptr<ebbrt::IOBuf>>
+ebbrt::EventPoll::Read(size_t len) {
+  throw std::runtime_error("EventPoll: Read unsupported");
+}
+
+void ebbrt::EventPoll::Write(std::unique_ptr<IOBuf> buf) {
+  throw std::runtime_error("EventPoll: Write unsupported");
+}
+
+ebbrt::Future<uint8_t> ebbrt::EventPoll::Close() {
+  std::unordered_map<int, std::unique_ptr<Watch>> watches;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(lock_);
+    watches.swap(watches_);
+  }
+  for (auto& kv : watches) {
+    kv.second->fd_->RemoveWatcher(*kv.second);
+  }
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  ready_.clear();
+  return MakeReadyFuture<uint8_t>(0);
+}
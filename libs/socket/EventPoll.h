@@ -0,0 +1,125 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef EVENTPOLL_H_
+#define EVENTPOLL_H_
+
+#include <memory>
+#include <unordered_map>
+
+#include "Vfs.h"
+#include <ebbrt/EbbAllocator.h>
+#include <ebbrt/Future.h>
+#include <ebbrt/LocalIdMap.h>
+#include <ebbrt/SpinLock.h>
+#include <ebbrt/Timer.h>
+
+namespace ebbrt {
+
+// An epoll style readiness notifier. Descriptors are added to the interest
+// set of an instance and report changes in their readiness to it, at which
+// point they are placed on a ready list. A wait only inspects the ready list,
+// so its cost is proportional to the number of ready descriptors rather than
+// the size of the interest set. Each instance is meant to be waited on from a
+// single context at a time (typically one instance per core).
+class EventPoll : public Vfs::Fd, public ebbrt::Timer::Hook {
+ public:
+  // Interest flags, in addition to the poll(2) event bits
+  static const constexpr uint32_t kOneShot = 1u << 30;
+  static const constexpr uint32_t kEdgeTriggered = 1u << 31;
+
+  struct Event {
+    uint32_t events;
+    uint64_t data;
+  };
+
+  static EbbRef<EventPoll> Create(EbbId id = ebb_allocator->AllocateLocal()) {
+    auto root = new EventPoll::Root();
+    local_id_map->Insert(
+        std::make_pair(id, static_cast<Vfs::Fd::Root*>(root)));
+    return EbbRef<EventPoll>(id);
+  }
+  static EventPoll& HandleFault(EbbId id) {
+    return static_cast<EventPoll&>(Vfs::Fd::HandleFault(id));
+  }
+  class Root : public Vfs::Fd::Root {
+    std::atomic<EventPoll*> theRep;
+
+   public:
+    Root() : theRep(nullptr){};
+    Vfs::Fd& HandleFault(EbbId id) override {
+      if (!theRep) {
+        auto tmp = new EventPoll();
+        EventPoll* null = nullptr;
+        if (!theRep.compare_exchange_strong(null, tmp)) {
+          delete tmp;
+        }
+      }
+      // Cache the reference to the rep in the local translation table
+      EbbRef<EventPoll>::CacheRef(id, *theRep);
+      return *theRep;
+    }
+  };
+
+  EventPoll() : flags_(0) {}
+  ~EventPoll();
+
+  // Interest set management, return 0 on success or an errno value
+  int Add(int fd, uint32_t events, uint64_t data);
+  int Modify(int fd, uint32_t events, uint64_t data);
+  int Remove(int fd);
+  // Wait up to timeout milliseconds (-1 to wait forever) for at least one
+  // descriptor to become ready. Returns the number of events stored.
+  int Wait(Event* events, int max_events, int timeout);
+
+  // inherited
+  ebbrt::Future<std::unique_ptr<IOBuf>> Read(size_t len) override;
+  void Write(std::unique_ptr<IOBuf> buf) override;
+  ebbrt::Future<uint8_t> Close() override;
+  uint32_t GetFlags() override { return flags_; };
+  void SetFlags(uint32_t f) override { flags_ = f; };
+  uint32_t Readiness() override;
+  void Fire() override;
+
+ private:
+  class Watch : public Vfs::Fd::Watcher {
+   public:
+    Watch(EventPoll& poll, int fd_int, EbbRef<Vfs::Fd> fd, uint32_t events,
+          uint64_t data)
+        : poll_(poll), fd_int_(fd_int), fd_(fd), events_(events),
+          data_(data) {}
+    void ReadinessChanged() override;
+    void Detached() override;
+
+   private:
+    EventPoll& poll_;
+    int fd_int_;
+    EbbRef<Vfs::Fd> fd_;
+    uint32_t events_;
+    uint64_t data_;
+    bool enabled_{true};
+    boost::intrusive::list_member_hook<> ready_hook_;
+    friend class EventPoll;
+  };
+
+  typedef boost::intrusive::list<
+      Watch,
+      boost::intrusive::member_hook<Watch, boost::intrusive::list_member_hook<>,
+                                    &Watch::ready_hook_>>
+      ReadyList;
+
+  void Signal(Watch& w);
+  void Forget(Watch& w);
+  int Collect(Event* events, int max_events);
+
+  std::unordered_map<int, std::unique_ptr<Watch>> watches_;
+  ReadyList ready_;
+  ebbrt::SpinLock lock_;
+  Promise<void> waiter_;
+  bool waiting_{false};
+  bool timed_out_{false};
+  uint32_t flags_;
+};
+}  // namespace ebbrt
+#endif  // EVENTPOLL_H_
@@ -0,0 +1,88 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LOCKFREERING_H_
+#define LOCKFREERING_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+#include <ebbrt/CacheAligned.h>
+
+namespace ebbrt {
+
+// A bounded multi-producer, multi-consumer queue. Each slot carries a
+// sequence number which tells producers and consumers whether it is free for
+// the current lap of the ring, so neither side ever takes a lock. Push fails
+// when the ring is full rather than waiting.
+template <typename T, size_t N> class LockFreeRing {
+  static_assert(N && !(N & (N - 1)), "ring size must be a power of two");
+
+ public:
+  LockFreeRing() : head_(0), tail_(0) {
+    for (size_t i = 0; i < N; ++i)
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  bool Push(T&& value) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      auto& slot = slots_[pos & (N - 1)];
+      auto seq = slot.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          slot.value = std::move(value);
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // full
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool Pop(T& value) {
+    auto pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+      auto& slot = slots_[pos & (N - 1)];
+      auto seq = slot.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          value = std::move(slot.value);
+          slot.seq.store(pos + N, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // empty
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool Empty() const {
+    auto pos = head_.load(std::memory_order_acquire);
+    auto seq = slots_[pos & (N - 1)].seq.load(std::memory_order_acquire);
+    return seq != pos + 1;
+  }
+
+ private:
+  struct alignas(cache_size) Slot {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  std::array<Slot, N> slots_;
+  alignas(cache_size) std::atomic<size_t> head_;
+  alignas(cache_size) std::atomic<size_t> tail_;
+};
+}  // namespace ebbrt
+#endif  // LOCKFREERING_H_
@@ -3,6 +3,7 @@
 //    (See accompanying file LICENSE_1_0.txt or copy at
 //          http://www.boost.org/LICENSE_1_0.txt)
 
+#include "EventPoll.h"
 #include "SocketManager.h"
 #include "Vfs.h"
 #include <ebbrt/Debug.h>
@@ -14,10 +15,119 @@
 #include <errno.h>
 #include <netdb.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
 #include "lwip/ip_addr.h"
 
+namespace {
+typedef ebbrt::SocketManager::UdpSocketFd UdpSocketFd;
+
+// The largest payload the network stack will put in one datagram: an IPv4
+// packet less the largest IPv4 header and the UDP header
+const constexpr size_t max_udp_payload_size = UINT16_MAX - 60 - 8;
+
+// Returns the udp socket behind a descriptor, or nullptr for other types
+UdpSocketFd* udp_socket(ebbrt::EbbRef<ebbrt::Vfs::Fd> fd) {
+  return dynamic_cast<UdpSocketFd*>(&*fd);
+}
+
+// Returns the event poll behind a descriptor, or nullptr for other types
+ebbrt::EventPoll* event_poll(ebbrt::EbbRef<ebbrt::Vfs::Fd> fd) {
+  return dynamic_cast<ebbrt::EventPoll*>(&*fd);
+}
+
+// Take the next queued datagram, waiting for one unless nonblocking
+bool udp_next(UdpSocketFd& udp, UdpSocketFd::Datagram& d, bool nonblocking) {
+  while (!udp.RecvBatch(&d, 1)) {
+    if (nonblocking)
+      return false;
+    udp.WaitReadable().Block();
+  }
+  return true;
+}
+
+// Scatter a datagram into an iovec, anything that doesn't fit is discarded
+size_t udp_copy_out(const ebbrt::IOBuf& buf, const struct iovec* iov,
+                    int iovlen, bool* truncated) {
+  size_t copied = 0;
+  size_t offset = 0;
+  int i = 0;
+  *truncated = false;
+  for (auto& b : buf) {
+    auto data = b.Data();
+    auto left = b.Length();
+    while (left && i < iovlen) {
+      auto len = std::min(left, iov[i].iov_len - offset);
+      std::memcpy(static_cast<uint8_t*>(iov[i].iov_base) + offset, data, len);
+      data += len;
+      left -= len;
+      offset += len;
+      copied += len;
+      if (offset == iov[i].iov_len) {
+        ++i;
+        offset = 0;
+      }
+    }
+    if (left) {
+      *truncated = true;
+      break;
+    }
+  }
+  return copied;
+}
+
+size_t iov_length(const struct iovec* iov, int iovlen) {
+  size_t len = 0;
+  for (int i = 0; i < iovlen; ++i)
+    len += iov[i].iov_len;
+  return len;
+}
+
+// Gather an iovec into a single buffer
+std::unique_ptr<ebbrt::MutUniqueIOBuf> udp_copy_in(const struct iovec* iov,
+                                                   int iovlen) {
+  auto buf = ebbrt::MakeUniqueIOBuf(iov_length(iov, iovlen));
+  auto data = buf->MutData();
+  for (int i = 0; i < iovlen; ++i) {
+    std::memcpy(data, iov[i].iov_base, iov[i].iov_len);
+    data += iov[i].iov_len;
+  }
+  return buf;
+}
+
+void udp_fill_addr(const UdpSocketFd::Datagram& d, void* name,
+                   socklen_t* namelen) {
+  if (!name || !namelen)
+    return;
+  struct sockaddr_in sin;
+  std::memset(&sin, 0, sizeof(sin));
+  sin.sin_len = sizeof(sin);
+  sin.sin_family = AF_INET;
+  sin.sin_port = ebbrt::htons(d.port);
+  sin.sin_addr.s_addr = d.addr.toU32();
+  std::memcpy(name, &sin, std::min<socklen_t>(*namelen, sizeof(sin)));
+  *namelen = sizeof(sin);
+}
+
+// Send to the address in name, or to the connected peer if there is none
+int udp_send(UdpSocketFd& udp, const void* name,
+             std::unique_ptr<ebbrt::IOBuf> buf) {
+  try {
+    if (name) {
+      auto saddr = static_cast<const struct sockaddr_in*>(name);
+      udp.SendTo(ebbrt::Ipv4Address(saddr->sin_addr.s_addr),
+                 ebbrt::ntohs(saddr->sin_port), std::move(buf));
+    } else {
+      udp.Write(std::move(buf));
+    }
+  } catch (std::runtime_error& e) {
+    return name ? EIO : EDESTADDRREQ;
+  }
+  return 0;
+}
+}  // namespace
+
 int lwip_listen(int s, int backlog) {
   // TODO(jmc): support backlog
   try {
@@ -48,6 +158,8 @@ int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen) {
     auto fd = ebbrt::root_vfs->Lookup(s);
     auto saddr = reinterpret_cast<const struct sockaddr_in*>(name);
     auto port = ebbrt::ntohs(saddr->sin_port);  // port arrives in network order
+    if (auto udp = udp_socket(fd))
+      return udp->Bind(port);
     return static_cast<ebbrt::EbbRef<ebbrt::SocketManager::SocketFd>>(fd)->Bind(
         port);
   } catch (std::invalid_argument& e) {
@@ -61,9 +173,14 @@ int lwip_connect(int s, const struct sockaddr* name, socklen_t namelen) {
   auto saddr = reinterpret_cast<const struct sockaddr_in*>(name);
   auto ip_addr = saddr->sin_addr.s_addr;  // ip arrives in network order
   auto port = ebbrt::ntohs(saddr->sin_port);  // port arrives in network order
+  auto fd = ebbrt::root_vfs->Lookup(s);
+  if (auto udp = udp_socket(fd)) {
+    // only sets the default destination
+    udp->Connect(ebbrt::Ipv4Address(ip_addr), port);
+    return 0;
+  }
   ebbrt::NetworkManager::TcpPcb pcb;
   pcb.Connect(ebbrt::Ipv4Address(ip_addr), port);
-  auto fd = ebbrt::root_vfs->Lookup(s);
   // TODO(jmc): verify fd type for connecting
   auto connection =
       static_cast<ebbrt::EbbRef<ebbrt::SocketManager::SocketFd>>(fd)
@@ -77,6 +194,10 @@ int lwip_connect(int s, const struct sockaddr* name, socklen_t namelen) {
 }
 
 int lwip_socket(int domain, int type, int protocol) {
+  if (domain == AF_INET && type == SOCK_DGRAM &&
+      (protocol == IPPROTO_IP || protocol == IPPROTO_UDP)) {
+    return ebbrt::socket_manager->NewIpv4UdpSocket();
+  }
   if (domain != AF_INET || type != SOCK_STREAM ||
       (protocol != IPPROTO_IP && protocol != IPPROTO_TCP)) {
     ebbrt::kabort("Socket type not supported");
@@ -90,6 +211,8 @@ int lwip_read(int s, void* mem, size_t len) {
   // A read with len=0 will create a future which can be used to signal
   // that a non-blocking socket has received data
   auto fd = ebbrt::root_vfs->Lookup(s);
+  if (udp_socket(fd))
+    return lwip_recvfrom(s, mem, len, 0, nullptr, nullptr);
   auto fdref = static_cast<ebbrt::EbbRef<ebbrt::SocketManager::SocketFd>>(fd);
 
   // return EAGAIN error for non-blocking sockets when no data is available
@@ -114,6 +237,8 @@ int lwip_read(int s, void* mem, size_t len) {
 
 int lwip_write(int s, const void* dataptr, size_t size) {
   auto fd = ebbrt::root_vfs->Lookup(s);
+  if (udp_socket(fd))
+    return lwip_sendto(s, dataptr, size, 0, nullptr, 0);
   auto buf = ebbrt::MakeUniqueIOBuf(size);
   std::memcpy(reinterpret_cast<void*>(buf->MutData()), dataptr, size);
   fd->Write(std::move(buf));
@@ -121,16 +246,17 @@ int lwip_write(int s, const void* dataptr, size_t size) {
 }
 
 int lwip_send(int s, const void* dataptr, size_t size, int flags) {
-  return lwip_write(s, dataptr, size);
+  return lwip_sendto(s, dataptr, size, flags, nullptr, 0);
 }
 
 int lwip_recv(int s, void* mem, size_t len, int flags) {
-  return lwip_read(s, mem, len);
+  return lwip_recvfrom(s, mem, len, flags, nullptr, nullptr);
 }
 
 int lwip_close(int s) {
   auto fd = ebbrt::root_vfs->Lookup(s);
   fd->Close().Block();
+  ebbrt::root_vfs->UnregisterFd(s);
   return 0;
 }
 
@@ -204,20 +330,183 @@ int lwip_setsockopt(int s, int level, int optname, const void* optval,
 
 int lwip_recvfrom(int s, void* mem, size_t len, int flags,
                   struct sockaddr* from, socklen_t* fromlen) {
-  EBBRT_UNIMPLEMENTED();
-  return 0;
+  ebbrt::EbbRef<ebbrt::Vfs::Fd> fd;
+  try {
+    fd = ebbrt::root_vfs->Lookup(s);
+  } catch (std::invalid_argument& e) {
+    errno = EBADF;
+    return -1;
+  }
+  auto udp = udp_socket(fd);
+  if (!udp)
+    return lwip_read(s, mem, len);
+
+  auto nonblocking = (udp->GetFlags() & O_NONBLOCK) || (flags & MSG_DONTWAIT);
+  UdpSocketFd::Datagram d;
+  if (!udp_next(*udp, d, nonblocking)) {
+    errno = EAGAIN;
+    return -1;
+  }
+  struct iovec iov = {mem, len};
+  bool truncated;
+  auto copied = udp_copy_out(*d.buf, &iov, 1, &truncated);
+  udp_fill_addr(d, from, fromlen);
+  return copied;
 }
 
 int lwip_sendto(int s, const void* dataptr, size_t size, int flags,
                 const struct sockaddr* to, socklen_t tolen) {
-  EBBRT_UNIMPLEMENTED();
-  return 0;
+  ebbrt::EbbRef<ebbrt::Vfs::Fd> fd;
+  try {
+    fd = ebbrt::root_vfs->Lookup(s);
+  } catch (std::invalid_argument& e) {
+    errno = EBADF;
+    return -1;
+  }
+  auto udp = udp_socket(fd);
+  if (!udp)
+    return lwip_write(s, dataptr, size);
+
+  if (size > max_udp_payload_size) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  auto buf = ebbrt::MakeUniqueIOBuf(size);
+  std::memcpy(reinterpret_cast<void*>(buf->MutData()), dataptr, size);
+  auto err = udp_send(*udp, to, std::move(buf));
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return size;
+}
+
+// Receive a batch of datagrams. Waits (unless nonblocking) for the first one
+// only, then returns whatever else is already queued. The timeout is ignored.
+int lwip_recvmmsg(int s, struct mmsghdr* msgvec, unsigned int vlen, int flags,
+                  struct timespec* timeout) {
+  ebbrt::EbbRef<ebbrt::Vfs::Fd> fd;
+  try {
+    fd = ebbrt::root_vfs->Lookup(s);
+  } catch (std::invalid_argument& e) {
+    errno = EBADF;
+    return -1;
+  }
+  auto udp = udp_socket(fd);
+  if (!udp) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  if (vlen == 0)
+    return 0;
+
+  auto nonblocking = (udp->GetFlags() & O_NONBLOCK) || (flags & MSG_DONTWAIT);
+  UdpSocketFd::Datagram d;
+  if (!udp_next(*udp, d, nonblocking)) {
+    errno = EAGAIN;
+    return -1;
+  }
+  unsigned int n = 0;
+  do {
+    auto& hdr = msgvec[n].msg_hdr;
+    bool truncated;
+    msgvec[n].msg_len =
+        udp_copy_out(*d.buf, hdr.msg_iov, hdr.msg_iovlen, &truncated);
+    hdr.msg_flags = truncated ? MSG_TRUNC : 0;
+    udp_fill_addr(d, hdr.msg_name, &hdr.msg_namelen);
+    ++n;
+  } while (n < vlen && udp->RecvBatch(&d, 1));
+  return n;
+}
+
+int lwip_sendmmsg(int s, struct mmsghdr* msgvec, unsigned int vlen,
+                  int flags) {
+  ebbrt::EbbRef<ebbrt::Vfs::Fd> fd;
+  try {
+    fd = ebbrt::root_vfs->Lookup(s);
+  } catch (std::invalid_argument& e) {
+    errno = EBADF;
+    return -1;
+  }
+  auto udp = udp_socket(fd);
+  if (!udp) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  unsigned int n = 0;
+  for (; n < vlen; ++n) {
+    auto& hdr = msgvec[n].msg_hdr;
+    auto len = iov_length(hdr.msg_iov, hdr.msg_iovlen);
+    auto err = EMSGSIZE;
+    if (len <= max_udp_payload_size)
+      err = udp_send(*udp, hdr.msg_name,
+                     udp_copy_in(hdr.msg_iov, hdr.msg_iovlen));
+    if (err) {
+      if (n == 0) {
+        errno = err;
+        return -1;
+      }
+      break;
+    }
+    msgvec[n].msg_len = len;
+  }
+  return n;
 }
 
 int lwip_select(int maxfdp1, fd_set* readset, fd_set* writeset,
                 fd_set* exceptset, struct timeval* timeout) {
-  EBBRT_UNIMPLEMENTED();
-  return 0;
+  std::vector<struct pollfd> fds;
+  for (int i = 0; i < maxfdp1; ++i) {
+    short events = 0;  // NOLINT
+    if (readset && FD_ISSET(i, readset))
+      events |= POLLIN;
+    if (writeset && FD_ISSET(i, writeset))
+      events |= POLLOUT;
+    if (exceptset && FD_ISSET(i, exceptset))
+      events |= POLLPRI;
+    if (events)
+      fds.push_back({i, events, 0});
+  }
+  int ms = -1;
+  if (timeout)
+    ms = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+
+  auto ret = poll(fds.data(), fds.size(), ms);
+  if (ret < 0)
+    return ret;
+
+  // poll counts a closed descriptor as ready, select fails on it
+  for (auto& pfd : fds) {
+    if (pfd.revents & POLLNVAL) {
+      errno = EBADF;
+      return -1;
+    }
+  }
+
+  // select reports the number of bits set rather than descriptors
+  int count = 0;
+  for (auto& pfd : fds) {
+    auto ready = pfd.revents;
+    if (readset && FD_ISSET(pfd.fd, readset)) {
+      if (ready & (POLLIN | POLLHUP | POLLERR))
+        ++count;
+      else
+        FD_CLR(pfd.fd, readset);
+    }
+    if (writeset && FD_ISSET(pfd.fd, writeset)) {
+      if (ready & (POLLOUT | POLLERR))
+        ++count;
+      else
+        FD_CLR(pfd.fd, writeset);
+    }
+    if (exceptset && FD_ISSET(pfd.fd, exceptset)) {
+      if (ready & POLLPRI)
+        ++count;
+      else
+        FD_CLR(pfd.fd, exceptset);
+    }
+  }
+  return count;
 }
 
 int lwip_ioctl(int s, long cmd, void* argp) {
@@ -252,34 +541,141 @@ int lwip_fcntl(int s, int cmd, int val) {
   return 0;
 }
 
+namespace {
+// Fill in revents for each descriptor from its current readiness and return
+// the number of descriptors with events
+int poll_scan(struct pollfd* fds, nfds_t nfds) {
+  int ready = 0;
+  for (nfds_t i = 0; i < nfds; ++i) {
+    fds[i].revents = 0;
+    if (fds[i].fd < 0)
+      continue;
+    try {
+      auto fd = ebbrt::root_vfs->Lookup(fds[i].fd);
+      fds[i].revents =
+          fd->Readiness() & (fds[i].events | POLLERR | POLLHUP);
+    } catch (std::invalid_argument& e) {
+      fds[i].revents = POLLNVAL;
+    }
+    if (fds[i].revents)
+      ++ready;
+  }
+  return ready;
+}
+}  // namespace
+
 int poll(struct pollfd* fds, nfds_t nfds, int timeout) {
-  // TODO(jmc): support sockets across cores
-  if (nfds > 1) {
-    EBBRT_UNIMPLEMENTED();
+  auto ready = poll_scan(fds, nfds);
+  if (ready || timeout == 0)
+    return ready;
+
+  // Nothing is ready yet, register interest in every descriptor with a
+  // transient EventPoll and sleep until one of them changes readiness
+  ebbrt::EventPoll ep;
+  for (nfds_t i = 0; i < nfds; ++i) {
+    if (fds[i].fd >= 0)
+      ep.Add(fds[i].fd, fds[i].events | ebbrt::EventPoll::kEdgeTriggered, i);
   }
-  for (uint32_t i = 0; i < nfds; ++i) {
-    auto pfd = fds[i];
-    if (pfd.fd < 0 || pfd.events == 0) {
-      EBBRT_UNIMPLEMENTED();
-      fds[i].revents = 0;
-      break;
+  auto deadline =
+      ebbrt::clock::Wall::Now() + std::chrono::milliseconds(timeout);
+  while (true) {
+    int remaining = -1;
+    if (timeout > 0) {
+      auto now = ebbrt::clock::Wall::Now();
+      if (now >= deadline)
+        return 0;
+      remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      deadline - now)
+                      .count() +
+                  1;
     }
-    auto fd = static_cast<ebbrt::EbbRef<ebbrt::SocketManager::SocketFd>>(
-        ebbrt::root_vfs->Lookup(pfd.fd));
+    ebbrt::EventPoll::Event ev;
+    if (ep.Wait(&ev, 1, remaining) == 0)
+      return 0;
+    ready = poll_scan(fds, nfds);
+    if (ready)
+      return ready;
+  }
+}
 
-    if ((pfd.events & POLLIN) && !fd->ReadWouldBlock()) {
-      fds[i].revents |= POLLIN;
-    }
-    if ((pfd.events & POLLOUT) && !fd->WriteWouldBlock()) {
-      fds[i].revents |= POLLOUT;
-    }
-    if ((~(POLLIN | POLLOUT) & pfd.events) != 0) {
-      ebbrt::kabort("Poll event type unsupported: %x", pfd.events);
-    }
+int epoll_create(int size) {
+  if (size <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  return epoll_create1(0);
+}
+
+int epoll_create1(int flags) {
+  return ebbrt::root_vfs->RegisterFd(ebbrt::EventPoll::Create());
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+  ebbrt::EbbRef<ebbrt::Vfs::Fd> epfd_ref;
+  try {
+    epfd_ref = ebbrt::root_vfs->Lookup(epfd);
+  } catch (std::invalid_argument& e) {
+    errno = EBADF;
+    return -1;
+  }
+  auto ep = event_poll(epfd_ref);
+  if (!ep) {
+    errno = EINVAL;
+    return -1;
+  }
+  if ((op == EPOLL_CTL_ADD || op == EPOLL_CTL_MOD) && !event) {
+    errno = EFAULT;
+    return -1;
+  }
+  int err;
+  switch (op) {
+  case EPOLL_CTL_ADD:
+    err = ep->Add(fd, event->events, event->data.u64);
+    break;
+  case EPOLL_CTL_MOD:
+    err = ep->Modify(fd, event->events, event->data.u64);
+    break;
+  case EPOLL_CTL_DEL:
+    err = ep->Remove(fd);
+    break;
+  default:
+    err = EINVAL;
+  }
+  if (err) {
+    errno = err;
+    return -1;
   }
   return 0;
 }
 
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents,
+               int timeout) {
+  if (maxevents <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  ebbrt::EbbRef<ebbrt::Vfs::Fd> epfd_ref;
+  try {
+    epfd_ref = ebbrt::root_vfs->Lookup(epfd);
+  } catch (std::invalid_argument& e) {
+    errno = EBADF;
+    return -1;
+  }
+  auto ep = event_poll(epfd_ref);
+  if (!ep) {
+    errno = EINVAL;
+    return -1;
+  }
+  const constexpr int kBatch = 64;
+  ebbrt::EventPoll::Event ready[kBatch];
+  auto n = ep->Wait(ready, std::min(maxevents, kBatch), timeout);
+  for (int i = 0; i < n; ++i) {
+    events[i].events = ready[i].events;
+    events[i].data.u64 = ready[i].data;
+  }
+  return n;
+}
+
 struct protoent* getprotobyname(const char* name) {
   if (strcmp(name, "tcp") || strcmp(name, "TCP")) {
     auto rtn = (struct protoent*)malloc(sizeof(struct protoent));
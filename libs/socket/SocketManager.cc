@@ -7,22 +7,28 @@
 #include "SocketManager.h"
 #include <ebbrt/Timer.h>
 
+#include <poll.h>
+
 int ebbrt::SocketManager::NewIpv4Socket() {
   auto sfd = ebbrt::SocketManager::SocketFd::Create();
   return ebbrt::root_vfs->RegisterFd(sfd);
 }
 
+int ebbrt::SocketManager::NewIpv4UdpSocket() {
+  auto ufd = ebbrt::SocketManager::UdpSocketFd::Create();
+  return ebbrt::root_vfs->RegisterFd(ufd);
+}
+
 void ebbrt::SocketManager::SocketFd::TcpSession::Receive(
     std::unique_ptr<ebbrt::MutIOBuf> b) {
-  {
-    std::lock_guard<ebbrt::SpinLock> guard(buf_lock_);
-    if (inbuf_) {
-      inbuf_->PrependChain(std::move(b));
-    } else {
-      inbuf_ = std::move(b);
-    }
-  }  // unlocked buf_lock_
+  if (inbuf_) {
+    inbuf_->PrependChain(std::move(b));
+  } else {
+    inbuf_ = std::move(b);
+  }
   check_read();
+  update_readable();
+  fd_->NotifyWatchers();
   return;
 }
 
@@ -36,12 +42,71 @@ void ebbrt::SocketManager::SocketFd::TcpSession::Fire() {
 
 void ebbrt::SocketManager::SocketFd::TcpSession::Connected() {
   connected_.SetValue(true);
+  update_writable();
+  fd_->NotifyWatchers();
   return;
 }
 
-void ebbrt::SocketManager::SocketFd::TcpSession::check_read() {
+void ebbrt::SocketManager::SocketFd::TcpSession::SendWindowIncrease() {
+  TcpHandler::SendWindowIncrease();
+  window_watched_.store(false);
+  update_writable();
+  fd_->NotifyWatchers();
+}
+
+void ebbrt::SocketManager::SocketFd::TcpSession::WatchWindow() {
+  if (!OnOwner()) {
+    // one check in flight is enough, however many pollers are asking
+    if (!window_watched_.exchange(true))
+      Post([this]() { WatchWindow(); });
+    return;
+  }
+  if (closed_)
+    return;
+  update_writable();
+  if (writable_.load()) {
+    // the window opened without a notification, wake the writers ourselves
+    window_watched_.store(false);
+    fd_->NotifyWatchers();
+  } else {
+    window_watched_.store(true);
+    Pcb().SetWindowNotify(true);
+  }
+}
+
+void ebbrt::SocketManager::SocketFd::TcpSession::Post(
+    ebbrt::MovableFunction<void()> func) {
+  auto op = new PostedOp(std::move(func));
+  auto head = posted_.load(std::memory_order_relaxed);
+  do {
+    op->next = head;
+  } while (!posted_.compare_exchange_weak(head, op, std::memory_order_release,
+                                          std::memory_order_relaxed));
+  // Only the first operation posted to an empty queue schedules a drain,
+  // everything posted before it runs is delivered in the same batch
+  if (!head)
+    event_manager->SpawnRemote([this]() { drain_posted(); }, cpu_);
+}
 
-  std::lock_guard<ebbrt::SpinLock> guard(buf_lock_);
+void ebbrt::SocketManager::SocketFd::TcpSession::drain_posted() {
+  auto op = posted_.exchange(nullptr, std::memory_order_acquire);
+  // the stack holds operations newest first, reverse it to preserve order
+  PostedOp* ordered = nullptr;
+  while (op) {
+    auto next = op->next;
+    op->next = ordered;
+    ordered = op;
+    op = next;
+  }
+  while (ordered) {
+    auto next = ordered->next;
+    ordered->func();
+    delete ordered;
+    ordered = next;
+  }
+}
+
+void ebbrt::SocketManager::SocketFd::TcpSession::check_read() {
   // Confirm we have received new data or an unfulfilled read request
   if (!inbuf_ || !read_blocked_) {
     return;
@@ -50,6 +115,10 @@ void ebbrt::SocketManager::SocketFd::TcpSession::check_read() {
   ebbrt::kbugon(read_.first.GetFuture().Ready());
   auto message_len = read_.second;
   auto buffer_len = inbuf_->ComputeChainDataLength();
+  if (read_partial_ && buffer_len > 0) {
+    // satisfy the read with whatever data is available
+    message_len = std::min(message_len, buffer_len);
+  }
 
   if (likely(buffer_len == message_len)) {
     read_.first.SetValue(std::move(inbuf_));
@@ -122,8 +191,10 @@ void ebbrt::SocketManager::SocketFd::TcpSession::check_read() {
 
 void ebbrt::SocketManager::SocketFd::TcpSession::Close() {
   read_.first.SetValue(ebbrt::MakeUniqueIOBuf(0));
+  closed_ = true;
   Shutdown();
   disconnected_.SetValue(0);
+  fd_->NotifyWatchers();
   return;
 }
 
@@ -137,19 +208,88 @@ ebbrt::SocketManager::SocketFd::Read(size_t len) {
 
   Promise<std::unique_ptr<ebbrt::IOBuf>> p;
   auto f = p.GetFuture();
+  if (!tcp_session_->OnOwner()) {
+    tcp_session_->Post([ this, len, p = std::move(p) ]() mutable {
+      Read(len).Then([p = std::move(p)](
+          ebbrt::Future<std::unique_ptr<IOBuf>> f) mutable {
+        p.SetValue(std::move(f.Get()));
+      });
+    });
+    return f;
+  }
   tcp_session_->read_blocked_ = true;
+  tcp_session_->read_partial_ = false;
   tcp_session_->read_ = std::make_pair(std::move(p), len);
   tcp_session_->check_read();
+  tcp_session_->update_readable();
   return std::move(f);
 }
 
+ebbrt::Future<std::unique_ptr<ebbrt::IOBuf>>
+ebbrt::SocketManager::SocketFd::Recv(size_t max_len) {
+  Promise<std::unique_ptr<ebbrt::IOBuf>> p;
+  auto f = p.GetFuture();
+  if (!tcp_session_->OnOwner()) {
+    tcp_session_->Post([ this, max_len, p = std::move(p) ]() mutable {
+      Recv(max_len).Then([p = std::move(p)](
+          ebbrt::Future<std::unique_ptr<IOBuf>> f) mutable {
+        p.SetValue(std::move(f.Get()));
+      });
+    });
+    return f;
+  }
+  tcp_session_->read_blocked_ = true;
+  tcp_session_->read_partial_ = true;
+  tcp_session_->read_ = std::make_pair(std::move(p), max_len);
+  tcp_session_->check_read();
+  tcp_session_->update_readable();
+  return f;
+}
+
+// Loans expose the receive buffer itself, so they are only available on the
+// core which owns the connection
+std::pair<const uint8_t*, size_t> ebbrt::SocketManager::SocketFd::Loan() {
+  kbugon(!tcp_session_->OnOwner(), "Socket loan off the owning core\n");
+  auto& inbuf = tcp_session_->inbuf_;
+  // drop any exhausted buffers from the front of the chain
+  while (inbuf && inbuf->Length() == 0) {
+    inbuf.reset(static_cast<MutIOBuf*>(inbuf->Pop().release()));
+  }
+  tcp_session_->update_readable();
+  if (!inbuf)
+    return std::make_pair(nullptr, 0);
+  return std::make_pair(inbuf->Data(), inbuf->Length());
+}
+
+void ebbrt::SocketManager::SocketFd::ReturnLoan(size_t consumed) {
+  kbugon(!tcp_session_->OnOwner(), "Socket loan off the owning core\n");
+  auto& inbuf = tcp_session_->inbuf_;
+  kassert(inbuf && inbuf->Length() >= consumed);
+  inbuf->Advance(consumed);
+  if (inbuf->Length() == 0)
+    inbuf.reset(static_cast<MutIOBuf*>(inbuf->Pop().release()));
+  tcp_session_->update_readable();
+}
+
 void ebbrt::SocketManager::SocketFd::Write(std::unique_ptr<IOBuf> buf) {
+  if (!tcp_session_->OnOwner()) {
+    tcp_session_->Post(
+        [ this, buf = std::move(buf) ]() mutable { Write(std::move(buf)); });
+    return;
+  }
   tcp_session_->Send(std::move(buf));
   tcp_session_->Pcb().Output();
+  tcp_session_->update_writable();
 }
 
 ebbrt::Future<uint8_t> ebbrt::SocketManager::SocketFd::Close() {
-  tcp_session_->Shutdown();
+  tcp_session_->closed_ = true;
+  if (tcp_session_->OnOwner()) {
+    tcp_session_->Shutdown();
+  } else {
+    // queued behind any writes already posted from this core
+    tcp_session_->Post([this]() { tcp_session_->Shutdown(); });
+  }
   return tcp_session_->disconnected_.GetFuture();
 }
 
@@ -198,11 +338,15 @@ int ebbrt::SocketManager::SocketFd::Listen() {
   try {
     listening_pcb_.Bind(
         listen_port_, [this](ebbrt::NetworkManager::TcpPcb pcb) {
-          std::lock_guard<ebbrt::SpinLock> guard(waiting_lock_);
-          ebbrt::kprintf("New connection arrived on listening socket.\n");
-          waiting_pcb_.push(std::move(pcb));
-          check_waiting();
+          {
+            std::lock_guard<ebbrt::SpinLock> guard(waiting_lock_);
+            ebbrt::kprintf("New connection arrived on listening socket.\n");
+            waiting_pcb_.push(std::move(pcb));
+            check_waiting();
+          }
+          NotifyWatchers();
         });
+    listening_ = true;
   } catch (std::exception& e) {
     // TODO(jmc): set errno
     ebbrt::kprintf("Unhandled exception caught: %s\n", e.what());
@@ -220,7 +364,40 @@ bool ebbrt::SocketManager::SocketFd::ReadWouldBlock() {
     return false;
   }
   // no outstanding reads
-  return (tcp_session_->inbuf_ == nullptr);
+  return !tcp_session_->readable_.load();
+}
+
+bool ebbrt::SocketManager::SocketFd::WriteWouldBlock() {
+  return !(Readiness() & POLLOUT);
+}
+
+// The readiness of a socket is computed from the state of its session (or its
+// accept queue when listening) rather than tracked as a separate mask, so a
+// level triggered poller can always ask again after consuming an event.
+uint32_t ebbrt::SocketManager::SocketFd::Readiness() {
+  uint32_t mask = 0;
+  if (listening_) {
+    std::lock_guard<ebbrt::SpinLock> guard(waiting_lock_);
+    if (!waiting_pcb_.empty())
+      mask |= POLLIN;
+    return mask;
+  }
+  if (!tcp_session_)
+    return mask;
+
+  if (tcp_session_->readable_.load())
+    mask |= POLLIN;
+  if (tcp_session_->closed_)
+    return mask | POLLIN | POLLHUP;
+
+  // The pcb belongs to the owning core, so the window is read from what the
+  // owner last published and any notification is armed there
+  if (tcp_session_->writable_.load()) {
+    mask |= POLLOUT;
+  } else {
+    tcp_session_->WatchWindow();
+  }
+  return mask;
 }
 
 ebbrt::Future<uint8_t>
@@ -230,3 +407,119 @@ ebbrt::SocketManager::SocketFd::Connect(ebbrt::NetworkManager::TcpPcb pcb) {
   return tcp_session_->connected_.GetFuture();
 }
 
+
+int ebbrt::SocketManager::UdpSocketFd::Bind(uint16_t port) {
+  std::lock_guard<ebbrt::SpinLock> guard(bind_lock_);
+  if (bound_)
+    return -1;
+  try {
+    pcb_.Bind(port);
+  } catch (std::exception& e) {
+    ebbrt::kprintf("Unhandled exception caught: %s\n", e.what());
+    return -1;
+  }
+  // Datagrams are delivered on whichever core received them
+  pcb_.Receive([this](ebbrt::Ipv4Address addr, uint16_t port,
+                      std::unique_ptr<ebbrt::MutIOBuf> buf) {
+    Deliver(addr, port, std::move(buf));
+  });
+  bound_ = true;
+  return 0;
+}
+
+void ebbrt::SocketManager::UdpSocketFd::Connect(ebbrt::Ipv4Address addr,
+                                                uint16_t port) {
+  peer_addr_ = addr;
+  peer_port_ = port;
+}
+
+void ebbrt::SocketManager::UdpSocketFd::SendTo(ebbrt::Ipv4Address addr,
+                                               uint16_t port,
+                                               std::unique_ptr<IOBuf> buf) {
+  // implicitly bind an ephemeral port, as on the first sendto(2). Should a
+  // concurrent send win the race to bind, ours fails but the socket is bound
+  if (!bound_ && Bind(0) != 0 && !bound_)
+    throw std::runtime_error("Failed to bind udp socket");
+  pcb_.SendTo(addr, port, std::move(buf));
+}
+
+void ebbrt::SocketManager::UdpSocketFd::Deliver(
+    ebbrt::Ipv4Address addr, uint16_t port,
+    std::unique_ptr<ebbrt::MutIOBuf> buf) {
+  if (!ring_.Push(Datagram{addr, port, std::move(buf)})) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Only take the lock when a reader is (or may be) waiting
+  if (waiting_.load()) {
+    Promise<void> waiter;
+    bool woken = false;
+    {
+      std::lock_guard<ebbrt::SpinLock> guard(waiter_lock_);
+      if (!waiters_.empty()) {
+        waiter = std::move(waiters_.front());
+        waiters_.pop();
+        woken = true;
+        waiting_.store(!waiters_.empty());
+      }
+    }
+    if (woken)
+      waiter.SetValue();
+  }
+  NotifyWatchers();
+}
+
+size_t ebbrt::SocketManager::UdpSocketFd::RecvBatch(Datagram* out,
+                                                    size_t max) {
+  size_t n = 0;
+  while (n < max && ring_.Pop(out[n]))
+    ++n;
+  return n;
+}
+
+ebbrt::Future<void> ebbrt::SocketManager::UdpSocketFd::WaitReadable() {
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(waiter_lock_);
+    waiting_.store(true);
+    // a datagram may have been queued before waiting_ was visible
+    if (ring_.Empty()) {
+      waiters_.emplace();
+      return waiters_.back().GetFuture();
+    }
+    waiting_.store(!waiters_.empty());
+  }
+  return MakeReadyFuture<void>();
+}
+
+ebbrt::Future<std::unique_ptr<ebbrt::IOBuf>>
+ebbrt::SocketManager::UdpSocketFd::Read(size_t len) {
+  Datagram d;
+  if (ring_.Pop(d))
+    return MakeReadyFuture<std::unique_ptr<IOBuf>>(std::move(d.buf));
+  return WaitReadable().Then([this, len](ebbrt::Future<void> f) {
+    f.Get();
+    return Read(len);
+  });
+}
+
+void ebbrt::SocketManager::UdpSocketFd::Write(std::unique_ptr<IOBuf> buf) {
+  if (!peer_port_)
+    throw std::runtime_error("Write on unconnected udp socket");
+  SendTo(peer_addr_, peer_port_, std::move(buf));
+}
+
+ebbrt::Future<uint8_t> ebbrt::SocketManager::UdpSocketFd::Close() {
+  bound_ = false;
+  return pcb_.Close().Then([](ebbrt::Future<void> f) {
+    f.Get();
+    return static_cast<uint8_t>(0);
+  });
+}
+
+uint32_t ebbrt::SocketManager::UdpSocketFd::Readiness() {
+  // sends never block, datagrams are dropped by the stack instead
+  uint32_t mask = POLLOUT;
+  if (!ring_.Empty())
+    mask |= POLLIN;
+  return mask;
+}
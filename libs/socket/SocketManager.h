@@ -7,13 +7,16 @@
 
 #include <utility>  // std::pair
 
+#include "LockFreeRing.h"
 #include "Vfs.h"
 #include <ebbrt/CacheAligned.h>
+#include <ebbrt/Cpu.h>
 #include <ebbrt/EbbAllocator.h>
 #include <ebbrt/EventManager.h>
 #include <ebbrt/Future.h>
 #include <ebbrt/GlobalStaticIds.h>
 #include <ebbrt/LocalIdMap.h>
+#include <ebbrt/MoveLambda.h>
 #include <ebbrt/SharedIOBufRef.h>
 #include <ebbrt/SpinLock.h>
 #include <ebbrt/StaticSharedEbb.h>
@@ -34,24 +37,57 @@ class SocketManager : public ebbrt::StaticSharedEbb<SocketManager>,
      public:
       void Fire() override;
       TcpSession(SocketFd* fd, ebbrt::NetworkManager::TcpPcb pcb)
-          : ebbrt::TcpHandler(std::move(pcb)), fd_(fd), read_blocked_(false) {}
+          : ebbrt::TcpHandler(std::move(pcb)), fd_(fd), read_blocked_(false) {
+        cpu_ = Pcb().GetCpu();
+      }
       void Connected() override;
       void Receive(std::unique_ptr<ebbrt::MutIOBuf> buf) override;
       void Close() override;
       void Abort() override;
+      void SendWindowIncrease() override;
+
+      // Run func on the core that owns the connection. Operations posted
+      // from other cores are queued and delivered in order, in batches
+      void Post(ebbrt::MovableFunction<void()> func);
+      bool OnOwner() { return static_cast<size_t>(Cpu::GetMine()) == cpu_; }
+      // Recheck the send window on the owning core and, if it is still
+      // closed, ask to be told when it reopens. Callable from any core
+      void WatchWindow();
 
      private:
       typedef std::pair<Promise<std::unique_ptr<ebbrt::IOBuf>>, size_t>
           PendingRead;
+      struct PostedOp {
+        explicit PostedOp(ebbrt::MovableFunction<void()> func)
+            : func(std::move(func)) {}
+        ebbrt::MovableFunction<void()> func;
+        PostedOp* next{nullptr};
+      };
       friend class SocketFd;
+      void drain_posted();
+      void update_readable() { readable_.store(inbuf_ != nullptr); }
+      void update_writable() {
+        writable_.store(Pcb().SendWindowRemaining() > 0);
+      }
+
       SocketFd* fd_;
+      size_t cpu_;
       ebbrt::NetworkManager::TcpPcb pcb_;
+      // inbuf_ and read_ are only accessed on the owning core
       std::unique_ptr<ebbrt::MutIOBuf> inbuf_;
-      ebbrt::SpinLock buf_lock_;
       PendingRead read_;
       Promise<uint8_t> disconnected_;
       Promise<uint8_t> connected_;
       bool read_blocked_;
+      bool read_partial_{false};
+      std::atomic<bool> readable_{false};
+      // the send window as of the last change seen on the owning core
+      std::atomic<bool> writable_{false};
+      // a window check has been posted or window notify is armed
+      std::atomic<bool> window_watched_{false};
+      std::atomic<bool> closed_{false};
+      // lock free stack of operations posted by other cores
+      std::atomic<PostedOp*> posted_{nullptr};
       void check_read();
     };
 
@@ -94,29 +130,122 @@ class SocketManager : public ebbrt::StaticSharedEbb<SocketManager>,
     ebbrt::Future<uint8_t> Close() override;
     uint32_t GetFlags() override { return flags_; };
     void SetFlags(uint32_t f) override { flags_ = f; };
+    uint32_t Readiness() override;
+
+    // Zero-copy extensions. Recv returns the received buffers themselves,
+    // waiting only if nothing is buffered, and Write takes ownership of the
+    // chain it is given. A loan exposes the first contiguous run of received
+    // data in place, it remains valid until ReturnLoan is called with the
+    // number of bytes consumed.
+    ebbrt::Future<std::unique_ptr<IOBuf>> Recv(size_t max_len = SIZE_MAX);
+    std::pair<const uint8_t*, size_t> Loan();
+    void ReturnLoan(size_t consumed);
 
     // NONBLOCKING
     bool ReadWouldBlock();
-    bool WriteWouldBlock() { return false; };
+    bool WriteWouldBlock();
 
    private:
     void install_pcb(ebbrt::NetworkManager::TcpPcb pcb);
     bool is_nonblocking() { return flags_ & O_NONBLOCK; }
     void check_waiting();
 
-    TcpSession* tcp_session_;
+    TcpSession* tcp_session_{nullptr};
     ebbrt::NetworkManager::ListeningTcpPcb listening_pcb_;
     bool connected_;
 
     // listening tcp socket
+    bool listening_{false};
     uint16_t listen_port_;
     std::queue<ebbrt::Promise<int>> waiting_accept_;
     std::queue<ebbrt::NetworkManager::TcpPcb> waiting_pcb_;
     ebbrt::SpinLock waiting_lock_;
     uint32_t flags_;
   };
+
+  class UdpSocketFd : public Vfs::Fd, public CacheAligned {
+   public:
+    struct Datagram {
+      ebbrt::Ipv4Address addr;
+      uint16_t port;
+      std::unique_ptr<ebbrt::MutIOBuf> buf;
+    };
+    // Datagrams queued beyond this are dropped
+    static const constexpr size_t kReceiveRingSize = 256;
+
+    UdpSocketFd() : flags_(0){};
+    static EbbRef<UdpSocketFd>
+    Create(EbbId id = ebb_allocator->AllocateLocal()) {
+      auto root = new UdpSocketFd::Root();
+      local_id_map->Insert(
+          std::make_pair(id, static_cast<Vfs::Fd::Root*>(root)));
+      return EbbRef<UdpSocketFd>(id);
+    }
+    static UdpSocketFd& HandleFault(EbbId id) {
+      return static_cast<UdpSocketFd&>(Vfs::Fd::HandleFault(id));
+    }
+    class Root : public Vfs::Fd::Root {
+      std::atomic<UdpSocketFd*> theRep;
+
+     public:
+      Root() : theRep(nullptr){};
+      Vfs::Fd& HandleFault(EbbId id) override {
+        if (!theRep) {
+          auto tmp = new UdpSocketFd();
+          UdpSocketFd* null = nullptr;
+          if (!theRep.compare_exchange_strong(null, tmp)) {
+            delete tmp;
+          }
+        }
+        // Cache the reference to the rep in the local translation table
+        EbbRef<UdpSocketFd>::CacheRef(id, *theRep);
+        return *theRep;
+      }
+    };
+
+    int Bind(uint16_t port);
+    void Connect(ebbrt::Ipv4Address addr, uint16_t port);
+    void SendTo(ebbrt::Ipv4Address addr, uint16_t port,
+                std::unique_ptr<IOBuf> buf);
+    // Dequeue up to max queued datagrams without waiting
+    size_t RecvBatch(Datagram* out, size_t max);
+    // Fulfilled once a datagram is queued. Each datagram wakes one waiter,
+    // which must retry RecvBatch as another reader may have taken it.
+    ebbrt::Future<void> WaitReadable();
+    uint64_t Dropped() const { return dropped_.load(); }
+    // inherited, Read returns a whole datagram and Write sends to the
+    // connected peer
+    ebbrt::Future<std::unique_ptr<IOBuf>> Read(size_t len) override;
+    void Write(std::unique_ptr<IOBuf> buf) override;
+    ebbrt::Future<uint8_t> Close() override;
+    uint32_t GetFlags() override { return flags_; };
+    void SetFlags(uint32_t f) override { flags_ = f; };
+    uint32_t Readiness() override;
+
+    // NONBLOCKING
+    bool ReadWouldBlock() { return ring_.Empty(); }
+
+   private:
+    void Deliver(ebbrt::Ipv4Address addr, uint16_t port,
+                 std::unique_ptr<ebbrt::MutIOBuf> buf);
+
+    ebbrt::NetworkManager::UdpPcb pcb_;
+    std::atomic<bool> bound_{false};
+    ebbrt::SpinLock bind_lock_;
+    ebbrt::Ipv4Address peer_addr_;
+    uint16_t peer_port_{0};
+    LockFreeRing<Datagram, kReceiveRingSize> ring_;
+    // set while waiters_ is non empty, so Deliver can skip the lock
+    std::atomic<bool> waiting_{false};
+    std::queue<Promise<void>> waiters_;
+    ebbrt::SpinLock waiter_lock_;
+    std::atomic<uint64_t> dropped_{0};
+    uint32_t flags_;
+  };
+
   explicit SocketManager(){};
   int NewIpv4Socket();
+  int NewIpv4UdpSocket();
 };
 
 // extern EbbId kSocketManagerEbbId;
@@ -6,17 +6,88 @@
 
 #include "Vfs.h"
 #include <ebbrt/Debug.h>
+#include <ebbrt/EventManager.h>
 
+ebbrt::Vfs::Table::Table(size_t capacity)
+    : capacity(capacity), slots(new std::atomic<EbbId>[capacity]) {
+  for (size_t i = 0; i < capacity; ++i)
+    slots[i].store(kFreeSlot, std::memory_order_relaxed);
+}
+
+ebbrt::Vfs::Vfs()
+    : table_(new Table(kInitialCapacity)), used_(kInitialCapacity / 64) {}
+
+// Allocate the lowest free descriptor
 int ebbrt::Vfs::RegisterFd(ebbrt::EbbRef<ebbrt::Vfs::Fd> ref) {
-  auto fd = fd_++;
-  descriptor_map_.emplace(fd, std::move(ref));
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  auto word = first_free_word_;
+  while (word < used_.size() && used_[word] == ~0ull)
+    ++word;
+  if (word == used_.size())
+    used_.push_back(0);
+  first_free_word_ = word;
+  auto bit = __builtin_ctzll(~used_[word]);
+  used_[word] |= 1ull << bit;
+  auto fd = word * 64 + bit;
+
+  auto table = table_.load(std::memory_order_relaxed);
+  if (fd >= table->capacity) {
+    // Grow the table, readers may still be using the old one so it is only
+    // freed once they have all moved on
+    auto grown = new Table(table->capacity * 2);
+    for (size_t i = 0; i < table->capacity; ++i) {
+      grown->slots[i].store(table->slots[i].load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+    }
+    table_.store(grown, std::memory_order_release);
+    event_manager->DoRcu([table]() { delete table; });
+    table = grown;
+  }
+  table->slots[fd].store(static_cast<EbbId>(ref), std::memory_order_release);
   return fd;
 }
 
-ebbrt::EbbRef<ebbrt::Vfs::Fd> ebbrt::Vfs::Lookup(int fd) {
-  auto it = descriptor_map_.find(fd);
-  if (it == descriptor_map_.end()) {
+// Release a descriptor so that its number can be reused. Whatever watches it
+// is detached first, so that nothing refers to the old descriptor by a number
+// which may be handed out again.
+void ebbrt::Vfs::UnregisterFd(int fd) {
+  Lookup(fd)->DetachWatchers();
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  auto table = table_.load(std::memory_order_relaxed);
+  if (static_cast<size_t>(fd) >= table->capacity ||
+      table->slots[fd].load(std::memory_order_relaxed) == kFreeSlot)
     throw std::invalid_argument("Failed to locate file descriptor");
+  table->slots[fd].store(kFreeSlot, std::memory_order_release);
+  used_[fd / 64] &= ~(1ull << (fd % 64));
+  first_free_word_ = std::min(first_free_word_, static_cast<size_t>(fd / 64));
+}
+
+void ebbrt::Vfs::Fd::AddWatcher(Watcher& w) {
+  std::lock_guard<ebbrt::SpinLock> guard(watcher_lock_);
+  watchers_.push_back(w);
+}
+
+void ebbrt::Vfs::Fd::RemoveWatcher(Watcher& w) {
+  std::lock_guard<ebbrt::SpinLock> guard(watcher_lock_);
+  if (w.watcher_hook_.is_linked())
+    watchers_.erase(watchers_.iterator_to(w));
+}
+
+void ebbrt::Vfs::Fd::NotifyWatchers() {
+  std::lock_guard<ebbrt::SpinLock> guard(watcher_lock_);
+  for (auto& w : watchers_) {
+    w.ReadinessChanged();
+  }
+}
+
+// Detached is called with the lock held, so a concurrent RemoveWatcher
+// cannot free the watcher while it runs. The watcher is unlinked first, so
+// Detached may free it.
+void ebbrt::Vfs::Fd::DetachWatchers() {
+  std::lock_guard<ebbrt::SpinLock> guard(watcher_lock_);
+  while (!watchers_.empty()) {
+    auto& w = watchers_.front();
+    watchers_.pop_front();
+    w.Detached();
   }
-  return it->second;
 }
@@ -6,7 +6,9 @@
 #define VFS_H_
 
 #include <atomic>
+#include <boost/intrusive/list.hpp>
 #include <ebbrt/CacheAligned.h>
+#include <ebbrt/Compiler.h>
 #include <ebbrt/Future.h>
 #include <ebbrt/GlobalStaticIds.h>
 #include <ebbrt/LocalIdMap.h>
@@ -14,7 +16,7 @@
 #include <ebbrt/SpinLock.h>
 #include <ebbrt/StaticSharedEbb.h>
 #include <ebbrt/UniqueIOBuf.h>
-#include <unordered_map>
+#include <vector>
 
 namespace ebbrt {
 
@@ -45,14 +47,73 @@ class Vfs : public ebbrt::StaticSharedEbb<Vfs>, public CacheAligned {
     virtual void Write(std::unique_ptr<IOBuf>) = 0;
     virtual uint32_t GetFlags() = 0;
     virtual void SetFlags(uint32_t) = 0;
+    // Current readiness of the descriptor, as a mask of poll(2) events
+    virtual uint32_t Readiness() = 0;
+
+    // An observer which is told whenever the readiness of a descriptor may
+    // have changed. Notifications are delivered on the core where the change
+    // occurred.
+    class Watcher {
+     public:
+      virtual void ReadinessChanged() = 0;
+      // The descriptor was closed and the watcher has been removed from it
+      virtual void Detached() = 0;
+      virtual ~Watcher() {}
+
+     private:
+      boost::intrusive::list_member_hook<> watcher_hook_;
+      friend class Fd;
+    };
+    void AddWatcher(Watcher& w);
+    // Does nothing if the watcher was already detached
+    void RemoveWatcher(Watcher& w);
+    void NotifyWatchers();
+    // Remove every watcher, as closing a descriptor drops it from all epoll
+    // interest sets on Linux
+    void DetachWatchers();
+
+   private:
+    typedef boost::intrusive::list<
+        Watcher, boost::intrusive::member_hook<
+                     Watcher, boost::intrusive::list_member_hook<>,
+                     &Watcher::watcher_hook_>>
+        WatcherList;
+    WatcherList watchers_;
+    ebbrt::SpinLock watcher_lock_;
   };
-  explicit Vfs() : fd_{0} {};
+  Vfs();
   int RegisterFd(ebbrt::EbbRef<ebbrt::Vfs::Fd>);
-  ebbrt::EbbRef<ebbrt::Vfs::Fd> Lookup(int fd_int);
+  void UnregisterFd(int fd_int);
+
+  // Lookups are lock free: the table is only ever replaced (when it grows)
+  // and the old one is freed after an RCU grace period, so a reader needs
+  // just a bounds check and a load
+  ebbrt::EbbRef<ebbrt::Vfs::Fd> Lookup(int fd_int) {
+    auto table = table_.load(std::memory_order_consume);
+    if (unlikely(static_cast<size_t>(fd_int) >= table->capacity))
+      throw std::invalid_argument("Failed to locate file descriptor");
+    auto id = table->slots[fd_int].load(std::memory_order_acquire);
+    if (unlikely(id == kFreeSlot))
+      throw std::invalid_argument("Failed to locate file descriptor");
+    return ebbrt::EbbRef<ebbrt::Vfs::Fd>(id);
+  }
 
  private:
-  std::atomic_int fd_;
-  std::unordered_map<int, ebbrt::EbbRef<ebbrt::Vfs::Fd>> descriptor_map_;
+  static const constexpr EbbId kFreeSlot = ~static_cast<EbbId>(0);
+  static const constexpr size_t kInitialCapacity = 64;
+
+  struct Table {
+    explicit Table(size_t capacity);
+    size_t capacity;
+    std::unique_ptr<std::atomic<EbbId>[]> slots;
+  };
+
+  std::atomic<Table*> table_;
+  // Descriptor allocation state, only touched with lock_ held. Bit i of used_
+  // is set when descriptor i is allocated
+  ebbrt::SpinLock lock_;
+  std::vector<uint64_t> used_;
+  size_t first_free_word_{0};
 };
 
 static const auto root_vfs = EbbRef<Vfs>(GenerateStaticEbbId("Vfs"));
@@ -0,0 +1,281 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "Collective.h"
+
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include "Debug.h"
+#include "SharedIOBufRef.h"
+#include "UniqueIOBuf.h"
+
+EBBRT_PUBLISH_TYPE(ebbrt, Collective);
+
+namespace {
+// Prefixes each member's data in a gather
+struct GatherEntry {
+  uint32_t rank;
+  uint32_t length;
+};
+
+// The tree is laid out over ranks relative to the root, so that any member
+// can be the root. A node's parent clears its lowest set bit, its children
+// set each of the bits below that one.
+size_t Relative(size_t rank, size_t root, size_t n) {
+  return (rank + n - root) % n;
+}
+
+size_t Absolute(size_t rel, size_t root, size_t n) { return (rel + root) % n; }
+
+size_t Parent(size_t rel) { return rel & (rel - 1); }
+
+std::vector<size_t> Children(size_t rel, size_t n) {
+  std::vector<size_t> children;
+  for (size_t mask = 1; mask < n; mask <<= 1) {
+    if (rel & mask)
+      break;
+    if (rel + mask < n)
+      children.push_back(rel + mask);
+  }
+  return children;
+}
+}  // namespace
+
+ebbrt::Collective::Group::Group(uint32_t id,
+                                std::vector<Messenger::NetworkId> members) {
+  auto local = messenger->LocalNetworkId();
+  auto it = members.begin();
+  while (it != members.end() && !(local == *it))
+    ++it;
+  if (it == members.end())
+    throw std::runtime_error("Collective::Group: local node is not a member");
+
+  info_.id = id;
+  info_.rank = it - members.begin();
+  info_.members =
+      std::make_shared<const std::vector<Messenger::NetworkId>>(members);
+}
+
+ebbrt::Collective::Collective() : Messagable<Collective>(kCollectiveId) {}
+
+ebbrt::Future<std::unique_ptr<ebbrt::IOBuf>>
+ebbrt::Collective::Broadcast(Group& group, size_t root,
+                             std::unique_ptr<IOBuf> data) {
+  kassert(root < group.Size());
+  kassert(data || group.Rank() != root);
+  auto seq = group.next_seq_.fetch_add(1, std::memory_order_relaxed);
+  return Start(group.info_, seq, root, /* reduce = */ false, std::move(data),
+               ReduceFunction());
+}
+
+ebbrt::Future<std::unique_ptr<ebbrt::IOBuf>>
+ebbrt::Collective::Reduce(Group& group, size_t root,
+                          std::unique_ptr<IOBuf> data, ReduceFunction func) {
+  kassert(root < group.Size());
+  auto seq = group.next_seq_.fetch_add(1, std::memory_order_relaxed);
+  return Start(group.info_, seq, root, /* reduce = */ true, std::move(data),
+               std::move(func));
+}
+
+// A reduce to rank 0 followed by a broadcast from it, which together cost
+// 2 log2(N) steps and leave no node handling more than log2(N) messages
+ebbrt::Future<std::unique_ptr<ebbrt::IOBuf>>
+ebbrt::Collective::AllReduce(Group& group, std::unique_ptr<IOBuf> data,
+                             ReduceFunction func) {
+  auto seq = group.next_seq_.fetch_add(2, std::memory_order_relaxed);
+  auto info = group.info_;
+  return Start(info, seq, 0, /* reduce = */ true, std::move(data),
+               std::move(func))
+      .Then([this, info, seq](Future<std::unique_ptr<IOBuf>> f) {
+        return Start(info, seq + 1, 0, /* reduce = */ false,
+                     std::move(f.Get()), ReduceFunction());
+      });
+}
+
+ebbrt::Future<void> ebbrt::Collective::Barrier(Group& group) {
+  return AllReduce(group, MakeUniqueIOBuf(0),
+                   [](std::unique_ptr<IOBuf> a, std::unique_ptr<IOBuf> b) {
+                     return a;
+                   })
+      .Then([](Future<std::unique_ptr<IOBuf>> f) { f.Get(); });
+}
+
+// A reduce whose combining step concatenates, each member's data carries its
+// rank so the root can sort the entries out
+ebbrt::Future<std::vector<std::unique_ptr<ebbrt::IOBuf>>>
+ebbrt::Collective::Gather(Group& group, size_t root,
+                          std::unique_ptr<IOBuf> data) {
+  auto n = group.Size();
+  auto entry = MakeUniqueIOBuf(sizeof(GatherEntry));
+  auto& e = *reinterpret_cast<GatherEntry*>(entry->MutData());
+  e.rank = group.Rank();
+  e.length = data ? data->ComputeChainDataLength() : 0;
+  if (data)
+    entry->PrependChain(std::move(data));
+
+  return Reduce(group, root, std::move(entry),
+                [](std::unique_ptr<IOBuf> a, std::unique_ptr<IOBuf> b) {
+                  a->PrependChain(std::move(b));
+                  return a;
+                })
+      .Then([n](Future<std::unique_ptr<IOBuf>> f) {
+        std::vector<std::unique_ptr<IOBuf>> ret;
+        auto buf = std::move(f.Get());
+        if (!buf)
+          return ret;
+
+        // slice the entries out of one shared buffer rather than copy them
+        ret.resize(n);
+        auto all = IOBuf::Create<SharedIOBufRef>(SharedIOBufRef::CloneView,
+                                                 Coalesce(std::move(buf)));
+        size_t offset = 0;
+        while (offset + sizeof(GatherEntry) <= all->Length()) {
+          GatherEntry e;
+          std::memcpy(&e, all->Data() + offset, sizeof(e));
+          offset += sizeof(e);
+          if (e.rank >= n || offset + e.length > all->Length())
+            throw std::runtime_error("Collective: malformed gather");
+          auto slice =
+              IOBuf::Create<SharedIOBufRef>(SharedIOBufRef::CloneView, *all);
+          slice->Advance(offset);
+          slice->TrimEnd(slice->Length() - e.length);
+          ret[e.rank] = std::move(slice);
+          offset += e.length;
+        }
+        return ret;
+      });
+}
+
+void ebbrt::Collective::ReceiveMessage(Messenger::NetworkId nid,
+                                       std::unique_ptr<IOBuf>&& buf) {
+  if (buf->ComputeChainDataLength() < sizeof(Header))
+    return;
+
+  auto dp = buf->GetDataPointer();
+  const auto& header = dp.Get<Header>();
+  auto key = Key(header.group, header.seq);
+  buf->AdvanceChain(sizeof(Header));
+  {
+    std::lock_guard<SpinLock> guard(lock_);
+    // a duplicate or stale message would create an operation nobody finishes
+    if (IsFinished(key))
+      return;
+    ops_[key].inbox.emplace_back(std::move(buf));
+  }
+  Advance(key);
+}
+
+ebbrt::Future<std::unique_ptr<ebbrt::IOBuf>>
+ebbrt::Collective::Start(const Group::Info& info, uint32_t seq, size_t root,
+                         bool reduce, std::unique_ptr<IOBuf> data,
+                         ReduceFunction func) {
+  auto key = Key(info.id, seq);
+  Future<std::unique_ptr<IOBuf>> ret;
+  {
+    std::lock_guard<SpinLock> guard(lock_);
+    auto& op = ops_[key];
+    kbugon(op.started, "Collective: operation %u of group %u reused\n", seq,
+           info.id);
+    op.started = true;
+    op.reduce = reduce;
+    op.info = info;
+    op.root = root;
+    op.value = std::move(data);
+    op.func = std::move(func);
+    ret = op.promise.GetFuture();
+  }
+  Advance(key);
+  return ret;
+}
+
+// Completes the local part of an operation once it has started and heard
+// from the tree: a broadcast waits for its parent, a reduce for all of its
+// children
+void ebbrt::Collective::Advance(uint64_t key) {
+  Op op;
+  {
+    std::lock_guard<SpinLock> guard(lock_);
+    auto it = ops_.find(key);
+    if (it == ops_.end() || !it->second.started)
+      return;
+
+    auto& o = it->second;
+    auto n = o.info.members->size();
+    auto rel = Relative(o.info.rank, o.root, n);
+    size_t expected = o.reduce ? Children(rel, n).size() : (rel ? 1 : 0);
+    if (o.inbox.size() < expected)
+      return;
+
+    op = std::move(o);
+    ops_.erase(it);
+    MarkFinished(key);
+  }
+
+  // Sends happen outside the lock, the messenger may deliver to us inline
+  const auto& members = *op.info.members;
+  auto n = members.size();
+  auto rel = Relative(op.info.rank, op.root, n);
+  if (op.reduce) {
+    auto value = std::move(op.value);
+    for (auto& in : op.inbox)
+      value = op.func(std::move(value), std::move(in));
+
+    if (rel == 0) {
+      op.promise.SetValue(std::move(value));
+      return;
+    }
+    SendTo(members[Absolute(Parent(rel), op.root, n)], key, std::move(value));
+    op.promise.SetValue(nullptr);
+    return;
+  }
+
+  auto value = rel ? std::move(op.inbox.front()) : std::move(op.value);
+  auto children = Children(rel, n);
+  if (!children.empty()) {
+    // each child gets a view of the one buffer rather than a copy
+    auto shared = IOBuf::Create<SharedIOBufRef>(SharedIOBufRef::CloneView,
+                                                Coalesce(std::move(value)));
+    for (auto child : children) {
+      SendTo(members[Absolute(child, op.root, n)], key,
+             IOBuf::Create<SharedIOBufRef>(SharedIOBufRef::CloneView, *shared));
+    }
+    value = std::move(shared);
+  }
+  op.promise.SetValue(std::move(value));
+}
+
+bool ebbrt::Collective::IsFinished(uint64_t key) {
+  auto it = finished_.find(key >> 32);
+  if (it == finished_.end())
+    return false;
+  auto seq = static_cast<uint32_t>(key);
+  return seq < it->second.next || it->second.beyond.count(seq);
+}
+
+void ebbrt::Collective::MarkFinished(uint64_t key) {
+  auto& f = finished_[key >> 32];
+  auto seq = static_cast<uint32_t>(key);
+  if (seq != f.next) {
+    f.beyond.insert(seq);
+    return;
+  }
+  ++f.next;
+  while (!f.beyond.empty() && *f.beyond.begin() == f.next) {
+    f.beyond.erase(f.beyond.begin());
+    ++f.next;
+  }
+}
+
+void ebbrt::Collective::SendTo(const Messenger::NetworkId& nid, uint64_t key,
+                               std::unique_ptr<IOBuf> data) {
+  auto buf = MakeUniqueIOBuf(sizeof(Header));
+  auto& header = *reinterpret_cast<Header*>(buf->MutData());
+  header.group = key >> 32;
+  header.seq = static_cast<uint32_t>(key);
+  if (data)
+    buf->PrependChain(std::move(data));
+  SendMessage(nid, std::move(buf));
+}
@@ -0,0 +1,138 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef COMMON_SRC_INCLUDE_EBBRT_COLLECTIVE_H_
+#define COMMON_SRC_INCLUDE_EBBRT_COLLECTIVE_H_
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "CacheAligned.h"
+#include "EbbRef.h"
+#include "Future.h"
+#include "Message.h"
+#include "MoveLambda.h"
+#include "SpinLock.h"
+#include "StaticIds.h"
+#include "StaticSharedEbb.h"
+
+namespace ebbrt {
+// Collective operations over a group of nodes. Data moves along a binomial
+// tree rooted at the operation's root: a node talks to its parent and to at
+// most log2(N) children, so the root's fan out is logarithmic and the
+// forwarding is spread over the interior nodes.
+//
+// Every member must take part in each operation of a group, and must issue
+// the group's operations in the same order. Messages for an operation a node
+// has not yet started are held until it does.
+class Collective : public StaticSharedEbb<Collective>,
+                   public CacheAligned,
+                   public Messagable<Collective> {
+ public:
+  // Combines two contributions to a reduction, it must be associative and
+  // commutative
+  typedef MovableFunction<std::unique_ptr<IOBuf>(std::unique_ptr<IOBuf>,
+                                                 std::unique_ptr<IOBuf>)>
+      ReduceFunction;
+
+  class Group {
+   public:
+    // Every member constructs the group with the same id and the members in
+    // the same order, the local node must be one of them. An id must not be
+    // reused, messages for operations it has already finished are dropped.
+    Group(uint32_t id, std::vector<Messenger::NetworkId> members);
+
+    size_t Size() const { return info_.members->size(); }
+    size_t Rank() const { return info_.rank; }
+
+   private:
+    struct Info {
+      uint32_t id;
+      std::shared_ptr<const std::vector<Messenger::NetworkId>> members;
+      size_t rank;
+    };
+
+    Info info_;
+    std::atomic<uint32_t> next_seq_{0};
+
+    friend class Collective;
+  };
+
+  static void ClassInit() {}  // no class wide static initialization logic
+
+  Collective();
+
+  // Every member receives the root's data, the others pass nullptr
+  Future<std::unique_ptr<IOBuf>> Broadcast(Group& group, size_t root,
+                                           std::unique_ptr<IOBuf> data);
+  // The root receives the combination of every member's data, the others
+  // nullptr
+  Future<std::unique_ptr<IOBuf>> Reduce(Group& group, size_t root,
+                                        std::unique_ptr<IOBuf> data,
+                                        ReduceFunction func);
+  // Every member receives the combination of every member's data
+  Future<std::unique_ptr<IOBuf>> AllReduce(Group& group,
+                                           std::unique_ptr<IOBuf> data,
+                                           ReduceFunction func);
+  // Fulfilled once every member has entered the barrier
+  Future<void> Barrier(Group& group);
+  // The root receives every member's data indexed by rank, the others an
+  // empty vector
+  Future<std::vector<std::unique_ptr<IOBuf>>>
+  Gather(Group& group, size_t root, std::unique_ptr<IOBuf> data);
+
+  void ReceiveMessage(Messenger::NetworkId nid, std::unique_ptr<IOBuf>&& buf);
+
+ private:
+  struct Header {
+    uint32_t group;
+    uint32_t seq;
+  };
+
+  struct Op {
+    bool started{false};
+    bool reduce{false};
+    Group::Info info;
+    size_t root{0};
+    // the local contribution, or the data at the root of a broadcast
+    std::unique_ptr<IOBuf> value;
+    ReduceFunction func;
+    // data received from the tree, possibly before the operation started
+    std::vector<std::unique_ptr<IOBuf>> inbox;
+    Promise<std::unique_ptr<IOBuf>> promise;
+  };
+
+  // The operations of a group finish here in roughly sequence order: all
+  // those below next are done, as are the few listed in beyond
+  struct Finished {
+    uint32_t next{0};
+    std::set<uint32_t> beyond;
+  };
+
+  static uint64_t Key(uint32_t group, uint32_t seq) {
+    return static_cast<uint64_t>(group) << 32 | seq;
+  }
+  // Both must hold lock_
+  bool IsFinished(uint64_t key);
+  void MarkFinished(uint64_t key);
+  Future<std::unique_ptr<IOBuf>> Start(const Group::Info& info, uint32_t seq,
+                                       size_t root, bool reduce,
+                                       std::unique_ptr<IOBuf> data,
+                                       ReduceFunction func);
+  void Advance(uint64_t key);
+  void SendTo(const Messenger::NetworkId& nid, uint64_t key,
+              std::unique_ptr<IOBuf> data);
+
+  SpinLock lock_;
+  std::unordered_map<uint64_t, Op> ops_;
+  std::unordered_map<uint32_t, Finished> finished_;
+};
+
+constexpr auto collective = EbbRef<Collective>(kCollectiveId);
+}  // namespace ebbrt
+
+#endif  // COMMON_SRC_INCLUDE_EBBRT_COLLECTIVE_H_
@@ -8,7 +8,13 @@
 #include "Hash.h"
 
 namespace ebbrt {
-enum : EbbId { kGlobalIdMapId, kFirstLocalId };
+enum : EbbId {
+  kGlobalIdMapId,
+  kNetStatsId,
+  kPacketCaptureId,
+  kCollectiveId,
+  kFirstLocalId
+};
 const constexpr EbbId kFirstStaticUserId = 0x8000;
 const constexpr EbbId GenerateStaticEbbId(hash::conststr a) {
   return kFirstStaticUserId | (static_string_hash(a) % 0x1000);
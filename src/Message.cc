@@ -5,27 +5,75 @@
 #include "Message.h"
 #include "Debug.h"
 
-#include <unordered_map>
+#include <cstring>
 
-std::unordered_map<uint64_t, ebbrt::MessagableBase& (*)(ebbrt::EbbId),
-                   ebbrt::Hasher>
-    ebbrt::fault_map __attribute__((init_priority(101)));
+namespace {
+struct MessagableType {
+  uint32_t code;
+  const char* name;
+  ebbrt::MessagableBase& (*fault)(ebbrt::EbbId);
+  ebbrt::MessagableBase& (*cast)(void*);
+};
 
-std::unordered_map<uint64_t, ebbrt::MessagableBase& (*)(void*),
-                   ebbrt::Hasher>
-    ebbrt::cast_map __attribute__((init_priority(102)));
+const constexpr size_t kMaxMessagableTypes = 255;
+// a power of two at least twice kMaxMessagableTypes, so probes stay short
+const constexpr size_t kTypeTableSize = 512;
 
-ebbrt::MessagableBase& ebbrt::GetMessagableRef(EbbId id, uint64_t type_code) {
-  auto local_entry = GetLocalEntry(id);
-  if (local_entry.ref == nullptr){
-    auto it = fault_map.find(type_code);
-    if (it == fault_map.end())
-      ebbrt::kabort("GetMessagableRef missing fault for type code");
-    return it->second(id);
-  } else {
-    auto it = cast_map.find(type_code);
-    if (it == cast_map.end())
-      ebbrt::kabort("GetMessagableRef missing cast function for type code");
-    return it->second(local_entry.ref);
+// Zero initialized, so it is usable by constructor functions regardless of
+// static initialization order. A slot with no name is empty.
+MessagableType types[kTypeTableSize];
+size_t type_count;
+
+// The slot holding code, or the empty slot where it would be inserted
+MessagableType& FindType(uint32_t code) {
+  auto i = code & (kTypeTableSize - 1);
+  while (types[i].name && types[i].code != code)
+    i = (i + 1) & (kTypeTableSize - 1);
+  return types[i];
+}
+}  // namespace
+
+// 32 bit FNV-1a
+uint32_t ebbrt::MessagableTypeCode(const char* name) {
+  uint32_t hash = 2166136261u;
+  for (auto p = name; *p; ++p) {
+    hash ^= static_cast<uint8_t>(*p);
+    hash *= 16777619u;
+  }
+  // a type landing on 1 as well is caught as a collision
+  return hash == kMessengerControlCode ? 1 : hash;
+}
+
+void ebbrt::RegisterMessagableType(const char* name,
+                                   MessagableBase& (*fault)(EbbId),
+                                   MessagableBase& (*cast)(void*)) {
+  auto code = MessagableTypeCode(name);
+  auto& entry = FindType(code);
+  if (entry.name) {
+    // published by more than one translation unit
+    if (std::strcmp(entry.name, name) == 0)
+      return;
+    kabort("Messagable type code collision between %s and %s\n", entry.name,
+           name);
   }
+  if (type_count == kMaxMessagableTypes)
+    kabort("Too many Messagable types\n");
+
+  ++type_count;
+  entry.code = code;
+  entry.name = name;
+  entry.fault = fault;
+  entry.cast = cast;
+}
+
+ebbrt::MessagableBase& ebbrt::GetMessagableRef(EbbId id, uint32_t type_code) {
+  auto& entry = FindType(type_code);
+  if (unlikely(!entry.name))
+    ebbrt::kabort("GetMessagableRef unknown type code %u\n", type_code);
+
+  auto local_entry = GetLocalEntry(id);
+  if (local_entry.ref == nullptr)
+    return entry.fault(id);
+
+  return entry.cast(local_entry.ref);
 }
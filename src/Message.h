@@ -15,13 +15,20 @@ class MessagableBase {
                                       std::unique_ptr<MutIOBuf>&& buf) = 0;
 };
 
-struct Hasher {
-  std::size_t operator()(uint64_t val) const { return val; }
-};
-extern std::unordered_map<uint64_t, MessagableBase& (*)(EbbId), Hasher>
-    fault_map;
-extern std::unordered_map<uint64_t, MessagableBase& (*)(void*), Hasher>
-    cast_map;
+// Messagable types are identified on the wire by a 32 bit code, a hash of
+// the mangled type name, so hosted and native agree on it without any
+// coordination. Codes are looked up in a fixed open addressed table, kept at
+// most half full, which is filled by EBBRT_PUBLISH_TYPE during static
+// initialization (two names hashing to the same code is caught there), so
+// that together with the per-core translation table a message is usually
+// dispatched with two array lookups.
+uint32_t MessagableTypeCode(const char* name);
+// Never returned by MessagableTypeCode, Messenger uses it for its own control
+// messages (e.g. returning flow control credit)
+const constexpr uint32_t kMessengerControlCode = 0;
+void RegisterMessagableType(const char* name,
+                            MessagableBase& (*fault)(EbbId),
+                            MessagableBase& (*cast)(void*));
 
 template <typename T> class Messagable : public MessagableBase {
  public:
@@ -32,7 +39,8 @@ template <typename T> class Messagable : public MessagableBase {
   }
   Future<void> SendMessage(EbbId id, Messenger::NetworkId nid,
                            std::unique_ptr<IOBuf>&& buf) {
-    return messenger->Send(nid, id, typeid(T).hash_code(), std::move(buf));
+    static const uint32_t type_code = MessagableTypeCode(typeid(T).name());
+    return messenger->Send(nid, id, type_code, std::move(buf));
   }
   void ReceiveMessageInternal(Messenger::NetworkId nid,
                               std::unique_ptr<MutIOBuf>&& buf) override {
@@ -43,7 +51,7 @@ template <typename T> class Messagable : public MessagableBase {
   EbbId id_;
 };
 
-MessagableBase& GetMessagableRef(EbbId id, uint64_t type_code);
+MessagableBase& GetMessagableRef(EbbId id, uint32_t type_code);
 }  // namespace ebbrt
 
 #define EBBRT_PUBLISH_TYPE(ns, type)                                           \
@@ -56,8 +64,8 @@ MessagableBase& GetMessagableRef(EbbId id, uint64_t type_code);
   }                                                                            \
                                                                                \
   __attribute__((constructor)) void ns##type##PublishFunction() {              \
-    ebbrt::cast_map.emplace(typeid(ns::type).hash_code(), ns##type##Translate); \
-    ebbrt::fault_map.emplace(typeid(ns::type).hash_code(), ns##type##Convert); \
+    ebbrt::RegisterMessagableType(typeid(ns::type).name(), ns##type##Convert,  \
+                                  ns##type##Translate);                        \
   }
 
 #endif  // COMMON_SRC_INCLUDE_EBBRT_MESSAGE_H_
@@ -0,0 +1,67 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef COMMON_SRC_INCLUDE_EBBRT_NETCOUNTERS_H_
+#define COMMON_SRC_INCLUDE_EBBRT_NETCOUNTERS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ebbrt {
+// Counters kept by the native network stack. The layout is also the wire
+// format used to report them to a hosted frontend, so fields may only be
+// appended.
+struct NetCounters {
+  // device
+  uint64_t rx_packets{0};
+  uint64_t rx_bytes{0};
+  uint64_t rx_drops{0};  // receive ring overrun
+  uint64_t tx_packets{0};
+  uint64_t tx_bytes{0};
+  uint64_t tx_drops{0};  // transmit ring exhausted
+  // ip
+  uint64_t ip_rx{0};
+  uint64_t ip_tx{0};
+  uint64_t ip_rx_drops{0};  // malformed or not addressed to us
+  uint64_t ip_csum_errors{0};  // ip and icmp header checksums
+  // arp
+  uint64_t arp_rx{0};
+  uint64_t arp_tx{0};
+  // icmp
+  uint64_t icmp_rx{0};
+  uint64_t icmp_tx{0};
+  // udp
+  uint64_t udp_rx{0};
+  uint64_t udp_tx{0};
+  uint64_t udp_no_port{0};
+  // tcp
+  uint64_t tcp_rx{0};
+  uint64_t tcp_tx{0};
+  uint64_t tcp_retransmits{0};
+  uint64_t tcp_out_of_order{0};
+  uint64_t tcp_rst_rx{0};
+  uint64_t tcp_rst_tx{0};
+  uint64_t tcp_steered{0};  // handed to the core owning the connection
+
+  NetCounters& operator+=(const NetCounters& other) {
+    auto dst = reinterpret_cast<uint64_t*>(this);
+    auto src = reinterpret_cast<const uint64_t*>(&other);
+    for (size_t i = 0; i < sizeof(NetCounters) / sizeof(uint64_t); ++i)
+      dst[i] += src[i];
+    return *this;
+  }
+};
+
+// Messages exchanged by the NetStats Ebb
+struct NetStatsRequest {
+  uint64_t id;
+};
+
+struct NetStatsReply {
+  uint64_t id;
+  NetCounters counters;
+};
+}  // namespace ebbrt
+
+#endif  // COMMON_SRC_INCLUDE_EBBRT_NETCOUNTERS_H_
@@ -0,0 +1,73 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef COMMON_SRC_INCLUDE_EBBRT_PCAP_H_
+#define COMMON_SRC_INCLUDE_EBBRT_PCAP_H_
+
+#include <cstdint>
+
+namespace ebbrt {
+namespace pcap {
+// The classic libpcap file format, as read by Wireshark and tcpdump
+const constexpr uint32_t kMagic = 0xa1b2c3d4;  // microsecond timestamps
+const constexpr uint16_t kVersionMajor = 2;
+const constexpr uint16_t kVersionMinor = 4;
+const constexpr uint32_t kLinkTypeEthernet = 1;
+// Largest frame we capture, an Ethernet header plus a full MTU
+const constexpr uint16_t kMaxSnapLen = 1514;
+
+struct FileHeader {
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int32_t thiszone;
+  uint32_t sigfigs;
+  uint32_t snaplen;
+  uint32_t network;
+};
+
+struct RecordHeader {
+  uint32_t ts_sec;
+  uint32_t ts_usec;
+  uint32_t incl_len;
+  uint32_t orig_len;
+};
+}  // namespace pcap
+
+// Selects the packets a PacketCapture records. Fields left as zero match
+// anything. Addresses are in network byte order, ports in host byte order.
+struct CaptureFilter {
+  static const constexpr uint8_t kRx = 1;
+  static const constexpr uint8_t kTx = 2;
+
+  uint32_t src_addr{0};
+  uint32_t dst_addr{0};
+  uint16_t src_port{0};
+  uint16_t dst_port{0};
+  uint8_t proto{0};
+  uint8_t tcp_flags{0};  // match if any of these flags are set
+  uint8_t direction{0};  // kRx and/or kTx
+  uint16_t snap_len{0};  // bytes kept of each packet, 0 keeps up to the max
+};
+
+// Messages exchanged by the PacketCapture Ebb. Every request is answered
+// with a reply, which for a drain is followed by the drained records in pcap
+// format.
+struct CaptureRequest {
+  enum Op : uint32_t { kStart, kStop, kDrain };
+
+  uint64_t id;
+  Op op;
+  CaptureFilter filter;
+};
+
+struct CaptureReply {
+  uint64_t id;
+  uint64_t dropped;  // records lost to full rings since capture began
+  uint32_t count;
+  uint32_t snap_len;
+};
+}  // namespace ebbrt
+
+#endif  // COMMON_SRC_INCLUDE_EBBRT_PCAP_H_
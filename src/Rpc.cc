@@ -0,0 +1,95 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "Rpc.h"
+
+#include <vector>
+
+#include "Compiler.h"
+#include "Debug.h"
+#include "EventManager.h"
+
+const constexpr std::chrono::milliseconds ebbrt::RpcTable::kTick;
+
+uint32_t ebbrt::RpcTable::Insert(std::unique_ptr<PendingBase> pending,
+                                 std::chrono::milliseconds timeout) {
+  size_t mine = Cpu::GetMine();
+  auto& core = cores_[mine];
+  auto id = static_cast<uint32_t>(core.next++ * Cpu::kMaxCpus + mine);
+  if (unlikely(core.calls.find(id) != core.calls.end()))
+    kabort("RpcTable: call id %u still outstanding\n", id);
+
+  if (timeout.count()) {
+    // round up, and allow for the part of the current tick already gone
+    auto ticks = (timeout + kTick - std::chrono::milliseconds(1)) / kTick;
+    pending->expiry = core.ticks + ticks + 1;
+    ++core.timed;
+    if (!core.armed) {
+      core.armed = true;
+      timer->Start(core, kTick, /* repeat = */ false);
+    }
+  }
+  core.calls.emplace(id, std::move(pending));
+  return id;
+}
+
+// Must be called on the call's core
+std::unique_ptr<ebbrt::RpcTable::PendingBase>
+ebbrt::RpcTable::Remove(uint32_t id) {
+  auto& core = cores_[CoreOf(id)];
+  auto it = core.calls.find(id);
+  if (it == core.calls.end())
+    return nullptr;
+
+  auto pending = std::move(it->second);
+  core.calls.erase(it);
+  if (pending->expiry && --core.timed == 0 && core.armed) {
+    timer->Stop(core);
+    core.armed = false;
+  }
+  return pending;
+}
+
+void ebbrt::RpcTable::Fail(uint32_t id, std::exception_ptr e) {
+  auto core = CoreOf(id);
+  if (core != Cpu::GetMine()) {
+    RunOn(core, [this, id, e]() { Fail(id, e); });
+    return;
+  }
+  auto pending = Remove(id);
+  if (!pending)
+    return;
+  pending->Fail(std::move(e));
+}
+
+void ebbrt::RpcTable::Core::Fire() {
+  armed = false;
+  ++ticks;
+  std::vector<std::unique_ptr<PendingBase>> expired;
+  for (auto it = calls.begin(); it != calls.end();) {
+    if (it->second->expiry && it->second->expiry <= ticks) {
+      expired.emplace_back(std::move(it->second));
+      it = calls.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  timed -= expired.size();
+  if (timed) {
+    armed = true;
+    timer->Start(*this, kTick, /* repeat = */ false);
+  }
+  // fail them last, a continuation may start another call on this core
+  for (auto& pending : expired)
+    pending->Fail(std::make_exception_ptr(RpcTimeout()));
+}
+
+void ebbrt::RpcTable::RunOn(size_t core, MovableFunction<void()> func) {
+#ifdef __ebbrt__
+  event_manager->SpawnRemote(std::move(func), core);
+#else
+  event_manager->SpawnRemote(std::move(func),
+                             Cpu::GetByIndex(core)->get_context());
+#endif
+}
@@ -0,0 +1,118 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef COMMON_SRC_INCLUDE_EBBRT_RPC_H_
+#define COMMON_SRC_INCLUDE_EBBRT_RPC_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "CacheAligned.h"
+#include "Cpu.h"
+#include "Future.h"
+#include "MoveLambda.h"
+#include "Timer.h"
+
+namespace ebbrt {
+class RpcTimeout : public std::runtime_error {
+ public:
+  RpcTimeout() : std::runtime_error("RPC timed out") {}
+};
+
+// Correlates the requests a Messagable sends with the replies it receives.
+// The caller starts a call, puts its id into the request and sends it. The
+// receive path hands the id found in the reply to Complete (or Fail), which
+// fulfills the call's future. Any number of calls may be outstanding to a
+// peer at once and their replies may arrive in any order.
+//
+// Each core keeps its own table of outstanding calls. The id of a call
+// records the core which made it, and a reply received on another core is
+// handed back to that one, so the tables are never shared and need no locks.
+// A call given a timeout fails with RpcTimeout once it expires (to within
+// kTick), and a late reply is then ignored. The table must not be destroyed
+// while calls are outstanding.
+class RpcTable {
+  template <typename T> struct NonDeduced { typedef T type; };
+
+ public:
+  static const constexpr std::chrono::milliseconds kTick{10};
+
+  template <typename T> struct Call {
+    uint32_t id;
+    Future<T> future;
+  };
+
+  // Must be called from a core of this machine
+  template <typename T>
+  Call<T>
+  Start(std::chrono::milliseconds timeout = std::chrono::milliseconds::zero()) {
+    auto pending = new Pending<T>();
+    auto future = pending->promise.GetFuture();
+    auto id = Insert(std::unique_ptr<PendingBase>(pending), timeout);
+    return Call<T>{id, std::move(future)};
+  }
+
+  // T must be given explicitly and match the call's Start, replies for calls
+  // which are no longer outstanding are dropped. May be called on any core.
+  template <typename T>
+  void Complete(uint32_t id, typename NonDeduced<T>::type value) {
+    auto core = CoreOf(id);
+    if (core != Cpu::GetMine()) {
+      RunOn(core, [this, id, value = std::move(value)]() mutable {
+        Complete<T>(id, std::move(value));
+      });
+      return;
+    }
+    auto pending = Remove(id);
+    if (!pending)
+      return;
+    static_cast<Pending<T>*>(pending.get())->promise.SetValue(std::move(value));
+  }
+
+  void Fail(uint32_t id, std::exception_ptr e);
+
+ private:
+  struct PendingBase {
+    virtual ~PendingBase() {}
+    virtual void Fail(std::exception_ptr e) = 0;
+    // tick of its core at which the call fails, 0 for no timeout
+    uint64_t expiry{0};
+  };
+
+  template <typename T> struct Pending : PendingBase {
+    void Fail(std::exception_ptr e) override {
+      promise.SetException(std::move(e));
+    }
+    Promise<T> promise;
+  };
+
+  // The core's tick only advances while it has calls with a timeout
+  struct alignas(cache_size) Core : Timer::Hook {
+    void Fire() override;
+
+    std::unordered_map<uint32_t, std::unique_ptr<PendingBase>> calls;
+    uint32_t next{0};
+    uint64_t ticks{0};
+    size_t timed{0};
+    bool armed{false};
+  };
+
+  // ids are a per core sequence number times kMaxCpus plus the core, so
+  // they keep their core when the sequence number wraps
+  static size_t CoreOf(uint32_t id) { return id % Cpu::kMaxCpus; }
+  uint32_t Insert(std::unique_ptr<PendingBase> pending,
+                  std::chrono::milliseconds timeout);
+  std::unique_ptr<PendingBase> Remove(uint32_t id);
+  static void RunOn(size_t core, MovableFunction<void()> func);
+
+  std::array<Core, Cpu::kMaxCpus> cores_;
+};
+}  // namespace ebbrt
+
+#endif  // COMMON_SRC_INCLUDE_EBBRT_RPC_H_
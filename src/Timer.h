@@ -9,6 +9,12 @@
 #include <set>
 
 #include <boost/intrusive/set.hpp>
+#ifndef __ebbrt__
+#include <memory>
+#include <unordered_map>
+
+#include <boost/asio/deadline_timer.hpp>
+#endif
 
 #include "MulticoreEbbStatic.h"
 
@@ -65,6 +71,11 @@ class Timer : public MulticoreEbbStatic<Timer> {
 
   uint64_t ticks_per_us_;
   boost::intrusive::multiset<Hook> timers_;
+#ifndef __ebbrt__
+  // the asio timer each started hook is waiting on, so Stop can cancel it
+  std::unordered_map<Hook*, std::shared_ptr<boost::asio::deadline_timer>>
+      started_;
+#endif
 };
 
 const constexpr auto timer = EbbRef<Timer>(Timer::static_id);
@@ -34,3 +34,26 @@ ebbrt::MakeUniqueIOBuf(size_t capacity, bool zero_memory) {
 
   return std::unique_ptr<MutUniqueIOBuf>(new (b) MutUniqueIOBuf(buf, capacity));
 }
+
+std::unique_ptr<ebbrt::IOBuf> ebbrt::Coalesce(std::unique_ptr<IOBuf> buf) {
+  auto len = buf->ComputeChainDataLength();
+  // Look for a single buffer holding all of the data, skipping any empty ones
+  // left in front of it (e.g. by AdvanceChain)
+  for (auto& b : *buf) {
+    if (b.Length() == len) {
+      if (&b == buf.get())
+        return buf;
+      return buf->UnlinkEnd(b);
+    }
+    if (b.Length())
+      break;
+  }
+
+  auto ret = MakeUniqueIOBuf(len);
+  auto data = ret->MutData();
+  for (auto& b : *buf) {
+    std::memcpy(data, b.Data(), b.Length());
+    data += b.Length();
+  }
+  return std::move(ret);
+}
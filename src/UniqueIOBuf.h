@@ -19,6 +19,10 @@ typedef MutIOBufBase<UniqueIOBufOwner> MutUniqueIOBuf;
 std::unique_ptr<MutUniqueIOBuf> MakeUniqueIOBuf(size_t capacity,
                                                 bool zero_memory = false);
 
+// Returns buf if its data is already in a single buffer, otherwise copies the
+// chain into one. For receivers which need contiguous data.
+std::unique_ptr<IOBuf> Coalesce(std::unique_ptr<IOBuf> buf);
+
 class UniqueIOBufOwner {
  public:
   const uint8_t* Buffer() const;
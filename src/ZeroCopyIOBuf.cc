@@ -0,0 +1,31 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "ZeroCopyIOBuf.h"
+
+ebbrt::ZeroCopyIOBufOwner::ZeroCopyIOBufOwner(
+    const uint8_t* ptr, size_t len,
+    std::shared_ptr<Completion> completion) noexcept
+    : ptr_(ptr), capacity_(len), completion_(std::move(completion)) {}
+
+const uint8_t* ebbrt::ZeroCopyIOBufOwner::Buffer() const { return ptr_; }
+
+size_t ebbrt::ZeroCopyIOBufOwner::Capacity() const { return capacity_; }
+
+std::shared_ptr<ebbrt::ZeroCopyIOBufOwner::Completion>
+ebbrt::MakeZeroCopyCompletion(MovableFunction<void()> func) {
+  return std::make_shared<ZeroCopyIOBufOwner::Completion>(std::move(func));
+}
+
+std::unique_ptr<ebbrt::ZeroCopyIOBuf> ebbrt::MakeZeroCopyIOBuf(
+    const uint8_t* ptr, size_t len,
+    std::shared_ptr<ZeroCopyIOBufOwner::Completion> completion) {
+  return IOBuf::Create<ZeroCopyIOBuf>(ptr, len, std::move(completion));
+}
+
+std::unique_ptr<ebbrt::ZeroCopyIOBuf>
+ebbrt::MakeZeroCopyIOBuf(const uint8_t* ptr, size_t len,
+                         MovableFunction<void()> func) {
+  return MakeZeroCopyIOBuf(ptr, len, MakeZeroCopyCompletion(std::move(func)));
+}
@@ -0,0 +1,61 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef COMMON_SRC_INCLUDE_EBBRT_ZEROCOPYIOBUF_H_
+#define COMMON_SRC_INCLUDE_EBBRT_ZEROCOPYIOBUF_H_
+
+#include <cstdlib>
+#include <memory>
+
+#include "IOBuf.h"
+#include "MoveLambda.h"
+
+namespace ebbrt {
+// An IOBuf which views memory owned by the application. The memory must stay
+// valid until the completion shared by the buffer(s) runs, which happens once
+// the last IOBuf (and any SharedIOBufRef clone of it) referencing it has been
+// destroyed.
+class ZeroCopyIOBufOwner {
+ public:
+  class Completion {
+   public:
+    explicit Completion(MovableFunction<void()> func)
+        : func_(std::move(func)) {}
+    ~Completion() {
+      if (func_)
+        func_();
+    }
+
+   private:
+    MovableFunction<void()> func_;
+  };
+
+  ZeroCopyIOBufOwner(const uint8_t* ptr, size_t len,
+                     std::shared_ptr<Completion> completion) noexcept;
+
+  const uint8_t* Buffer() const;
+  size_t Capacity() const;
+
+ private:
+  const uint8_t* ptr_;
+  size_t capacity_;
+  std::shared_ptr<Completion> completion_;
+};
+
+typedef IOBufBase<ZeroCopyIOBufOwner> ZeroCopyIOBuf;
+
+// Create a completion to be shared by several regions which are sent together
+std::shared_ptr<ZeroCopyIOBufOwner::Completion>
+MakeZeroCopyCompletion(MovableFunction<void()> func);
+
+std::unique_ptr<ZeroCopyIOBuf>
+MakeZeroCopyIOBuf(const uint8_t* ptr, size_t len,
+                  std::shared_ptr<ZeroCopyIOBufOwner::Completion> completion);
+
+std::unique_ptr<ZeroCopyIOBuf> MakeZeroCopyIOBuf(const uint8_t* ptr,
+                                                 size_t len,
+                                                 MovableFunction<void()> func);
+}  // namespace ebbrt
+
+#endif  // COMMON_SRC_INCLUDE_EBBRT_ZEROCOPYIOBUF_H_
@@ -4,62 +4,52 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "Messenger.h"
+#include "../Message.h"
 #include "../UniqueIOBuf.h"
 #include "GlobalIdMap.h"
 #include "NodeAllocator.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 namespace bai = boost::asio::ip;
 
 ebbrt::Messenger::Messenger() {
+  bai::tcp::endpoint endpoint(bai::address_v4(), 0);
+  if (auto str = getenv("EBBRT_MESSENGER_ADDRESS")) {
+    local_addr_ = bai::address_v4::from_string(str);
+    endpoint.address(local_addr_);
+  }
+  if (auto str = getenv("EBBRT_MESSENGER_PORT"))
+    endpoint.port(std::stoi(str));
   auto acceptor = std::make_shared<boost::asio::ip::tcp::acceptor>(
-      active_context->io_service_, bai::tcp::endpoint(bai::address_v4(), 0));
+      active_context->io_service_, endpoint);
   auto socket = std::make_shared<boost::asio::ip::tcp::socket>(
       active_context->io_service_);
   port_ = acceptor->local_endpoint().port();
   DoAccept(std::move(acceptor), std::move(socket));
+
+  // Processes on this host find the shared memory transport by our port
+  try {
+    auto shm_acceptor =
+        std::make_shared<boost::asio::local::stream_protocol::acceptor>(
+            active_context->io_service_,
+            boost::asio::local::stream_protocol::endpoint(
+                ShmName(local_addr_, port_)));
+    auto shm_socket =
+        std::make_shared<boost::asio::local::stream_protocol::socket>(
+            active_context->io_service_);
+    DoShmAccept(std::move(shm_acceptor), std::move(shm_socket));
+  } catch (boost::system::system_error& e) {
+    std::cerr << "Messenger: shared memory transport unavailable: "
+              << e.what() << std::endl;
+  }
 }
 
 ebbrt::Future<void> ebbrt::Messenger::Send(NetworkId to, EbbId id,
-                                           uint64_t type_code,
+                                           uint32_t type_code,
                                            std::unique_ptr<IOBuf>&& data) {
-  // make sure we have a pending connection
-  auto ip = to.ip_.to_ulong();
-  {
-    std::lock_guard<std::mutex> lock(m_);
-    auto it = connection_map_.find(ip);
-    if (it == connection_map_.end()) {
-      auto endpoint = bai::tcp::endpoint(to.ip_, port_);
-      auto& p = promise_map_[ip];
-      connection_map_.emplace(ip, p.GetFuture().Share());
-      std::queue<message_queue_entry_t> foo;
-      message_queue_.emplace(ip, std::move(foo));
-      auto socket =
-          std::make_shared<bai::tcp::socket>(active_context->io_service_);
-      async_connect(
-          *socket, &endpoint, (&endpoint) + 1,
-          EventManager::WrapHandler([socket, ip,
-                                     this](const boost::system::error_code& ec,
-                                           bai::tcp::endpoint* /* unused */) {
-            if (!ec) {
-              auto session = std::make_shared<Session>(std::move(*socket));
-              session->Start();
-              {
-                std::lock_guard<std::mutex> lock(m_);
-                while (!message_queue_[ip].empty()) {
-                  session->Send(std::move(message_queue_[ip].front().second));
-                  message_queue_[ip].front().first.SetValue();
-                  message_queue_[ip].pop();
-                }
-                promise_map_[ip].SetValue(
-                    std::weak_ptr<Session>(std::move(session)));
-              }
-            }
-          }));
-    }
-  }
-
   // construct message
   auto buf = MakeUniqueIOBuf(sizeof(Header));
   auto dp = buf->GetMutDataPointer();
@@ -68,20 +58,92 @@ ebbrt::Future<void> ebbrt::Messenger::Send(NetworkId to, EbbId id,
   h.type_code = type_code;
   h.id = id;
   buf->PrependChain(std::move(data));
+
+  auto ip = to.ip_.to_ulong();
+  std::shared_ptr<Transport> session;
+  Future<void> queued;
+  auto connect = false;
   {
     std::lock_guard<std::mutex> lock(m_);
-    if (!connection_map_[ip].Ready()) {
+    auto it = connection_map_.find(ip);
+    if (it == connection_map_.end()) {
+      // we don't have a pending connection, start one once the lock is
+      // dropped
+      auto& p = promise_map_[ip];
+      it = connection_map_.emplace(ip, p.GetFuture().Share()).first;
+      message_queue_.emplace(ip, std::deque<message_queue_entry_t>());
+      connect = true;
+    }
+    if (it->second.Ready()) {
+      session = it->second.Get().lock();
+    } else {
       // add to message queue
       Promise<void> p;
-      auto f = p.GetFuture();
-      message_queue_entry_t pair = std::make_pair(std::move(p), std::move(buf));
-      message_queue_[ip].emplace(std::move(pair));
-      return f;
+      queued = p.GetFuture();
+      message_queue_[ip].emplace_back(std::move(p), std::move(buf));
     }
   }
+  if (connect)
+    Connect(to);
+  if (!session)
+    return queued;
   // send message immediately
-  auto f = connection_map_[ip].Get();
-  return f.lock()->Send(std::move(buf));
+  return session->Send(std::move(buf));
+}
+
+// Set up a transport to a peer, outside of m_ as creating a shared memory
+// session or a socket may block
+void ebbrt::Messenger::Connect(NetworkId to) {
+  auto ip = to.ip_.to_ulong();
+  if (auto session = ShmConnect(to)) {
+    Connected(ip, std::move(session));
+    return;
+  }
+
+  auto endpoint = bai::tcp::endpoint(to.ip_, port_);
+  auto socket = std::make_shared<bai::tcp::socket>(active_context->io_service_);
+  if (!local_addr_.is_unspecified()) {
+    // connect from our own address, which is how the peer knows us. The
+    // socket's own async_connect keeps it open (and bound), unlike the free
+    // function
+    socket->open(bai::tcp::v4());
+    socket->bind(bai::tcp::endpoint(local_addr_, 0));
+  }
+  socket->async_connect(
+      endpoint, EventManager::WrapHandler([socket, ip, this](
+                    const boost::system::error_code& ec) {
+        if (!ec) {
+          auto session = std::make_shared<Session>(std::move(*socket));
+          session->Start();
+          Connected(ip, std::move(session));
+        }
+      }));
+}
+
+// Publish a new transport to a peer and send what was queued while
+// connecting
+void ebbrt::Messenger::Connected(uint32_t ip,
+                                 std::shared_ptr<Transport> session) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto& queue = message_queue_[ip];
+  while (!queue.empty()) {
+    auto& entry = queue.front();
+    session->Send(std::move(entry.second))
+        .Then([p = std::move(entry.first)](Future<void> f) mutable {
+          try {
+            f.Get();
+            p.SetValue();
+          } catch (...) {
+            p.SetException(std::current_exception());
+          }
+        });
+    queue.pop_front();
+  }
+  message_queue_.erase(ip);
+  // the connection may be forgotten and made again later
+  auto p = std::move(promise_map_[ip]);
+  promise_map_.erase(ip);
+  p.SetValue(std::weak_ptr<Transport>(std::move(session)));
 }
 
 void ebbrt::Messenger::DoAccept(
@@ -93,21 +155,66 @@ void ebbrt::Messenger::DoAccept(
     if (!ec) {
       auto addr = socket->remote_endpoint().address().to_v4().to_ulong();
       std::lock_guard<std::mutex> lock(m_);
-      if (connection_map_.find(addr) != connection_map_.end())
-        throw std::runtime_error("Store to promise");
-
       auto session = std::make_shared<Session>(std::move(*socket));
       session->Start();
-      connection_map_.emplace(
-          addr,
-          MakeReadyFuture<std::weak_ptr<Session>>(std::move(session)).Share());
+      // A native peer opens a connection from each of its cores (its
+      // stripes). We keep sending on the first one, the others are kept alive
+      // by their reads and deliver what the peer sends on them.
+      auto it = connection_map_.find(addr);
+      if (it == connection_map_.end()) {
+        connection_map_.emplace(
+            addr, MakeReadyFuture<std::weak_ptr<Transport>>(std::move(session))
+                      .Share());
+      } else if (it->second.Ready() && it->second.Get().expired()) {
+        it->second =
+            MakeReadyFuture<std::weak_ptr<Transport>>(std::move(session))
+                .Share();
+      }
       DoAccept(std::move(acceptor), std::move(socket));
     }
   }));
 }
 
+void ebbrt::Messenger::Forget(uint32_t ip, Transport* transport) {
+  std::lock_guard<std::mutex> lock(m_);
+  auto it = connection_map_.find(ip);
+  if (it == connection_map_.end() || !it->second.Ready())
+    return;
+  auto current = it->second.Get().lock();
+  if (!current || current.get() == transport)
+    connection_map_.erase(it);
+}
+
 uint16_t ebbrt::Messenger::GetPort() { return port_; }
 
+void ebbrt::Messenger::SetSharedMemory(bool enable) { shm_enabled_ = enable; }
+
+ebbrt::Messenger::QueueStats ebbrt::Messenger::GetQueueStats(NetworkId nid) {
+  auto ip = nid.ip_.to_ulong();
+  std::shared_ptr<Transport> session;
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    auto it = connection_map_.find(ip);
+    if (it != connection_map_.end() && it->second.Ready()) {
+      session = it->second.Get().lock();
+    } else {
+      // still connecting, everything sent so far is waiting
+      QueueStats stats{0, 0, kCreditWindow};
+      auto q = message_queue_.find(ip);
+      if (q != message_queue_.end()) {
+        for (auto& entry : q->second) {
+          ++stats.messages;
+          stats.bytes += entry.second->ComputeChainDataLength();
+        }
+      }
+      return stats;
+    }
+  }
+  if (!session)
+    return QueueStats{0, 0, 0};
+  return session->GetQueueStats();
+}
+
 ebbrt::Messenger::Session::Session(bai::tcp::socket socket)
     : socket_(std::move(socket)) {
   socket_.set_option(boost::asio::ip::tcp::no_delay(true));
@@ -115,45 +222,127 @@ ebbrt::Messenger::Session::Session(bai::tcp::socket socket)
 
 void ebbrt::Messenger::Session::Start() { ReadHeader(); }
 
-namespace {
-class IOBufToCBS {
- public:
-  explicit IOBufToCBS(std::unique_ptr<const ebbrt::IOBuf>&& buf)
-      : buf_(std::move(buf)) {
-    buf_vec_.reserve(buf_->ComputeChainDataLength());
-    for (auto& b : *buf_) {
-      buf_vec_.emplace_back(b.Data(), b.Length());
-    }
+// Charge a message against the peer's credit and hand it to the writer, or
+// hold it back until enough credit is returned. A message is let through
+// whenever some credit remains, so one larger than the window cannot stall
+// forever.
+ebbrt::Future<void>
+ebbrt::Messenger::Session::Send(std::unique_ptr<IOBuf>&& data) {
+  auto len = data->ComputeChainDataLength();
+  Promise<void> promise;
+  auto ret = promise.GetFuture();
+  // Enqueue under the lock so that messages released by Grant cannot be
+  // overtaken by later ones
+  std::lock_guard<std::mutex> lock(credit_lock_);
+  if (waiting_.empty() && credit_ > 0) {
+    credit_ -= len;
+    Enqueue(std::move(data), std::move(promise));
+  } else {
+    waiting_len_ += len;
+    waiting_.emplace_back(Waiting{std::move(data), len, std::move(promise)});
   }
+  return ret;
+}
 
-  typedef boost::asio::const_buffer value_type;
-  typedef std::vector<boost::asio::const_buffer>::const_iterator const_iterator;
+// Credit returned by the peer, release whatever now fits
+void ebbrt::Messenger::Session::Grant(uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(credit_lock_);
+  credit_ += bytes;
+  while (!waiting_.empty() && credit_ > 0) {
+    auto& w = waiting_.front();
+    credit_ -= w.len;
+    waiting_len_ -= w.len;
+    Enqueue(std::move(w.buf), std::move(w.promise));
+    waiting_.pop_front();
+  }
+}
 
-  const_iterator begin() const { return buf_vec_.cbegin(); }
-  const_iterator end() const { return buf_vec_.cend(); }
+// Tell the peer it may send as many bytes again as we have delivered. Control
+// messages are not charged against credit themselves.
+void ebbrt::Messenger::Session::ReturnCredit() {
+  auto buf = MakeUniqueIOBuf(sizeof(Header) + sizeof(uint64_t));
+  auto dp = buf->GetMutDataPointer();
+  auto& h = dp.Get<Header>();
+  h.length = sizeof(uint64_t);
+  h.id = 0;
+  h.type_code = kMessengerControlCode;
+  dp.Get<uint64_t>() = consumed_;
+  consumed_ = 0;
+  Enqueue(std::move(buf), Promise<void>());
+}
 
- private:
-  std::shared_ptr<const ebbrt::IOBuf> buf_;
-  std::vector<boost::asio::const_buffer> buf_vec_;
-};
-}  // namespace
+ebbrt::Messenger::QueueStats ebbrt::Messenger::Session::GetQueueStats() {
+  std::lock_guard<std::mutex> lock(credit_lock_);
+  return QueueStats{waiting_.size(), waiting_len_, credit_};
+}
 
-ebbrt::Future<void>
-ebbrt::Messenger::Session::Send(std::unique_ptr<IOBuf>&& data) {
-  auto p = new Promise<void>();
-  auto ret = p->GetFuture();
-  auto self(shared_from_this());
+// Queue a message for the session's writer. Whichever sender finds no write
+// in progress becomes the writer, so senders never wait on each other.
+void ebbrt::Messenger::Session::Enqueue(std::unique_ptr<IOBuf> buf,
+                                        Promise<void> promise) {
+  auto node = new SendNode{nullptr, std::move(buf), std::move(promise)};
+
+  auto head = send_head_.load(std::memory_order_relaxed);
+  do {
+    node->next = head;
+  } while (!send_head_.compare_exchange_weak(head, node,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+
+  if (!writing_.exchange(true, std::memory_order_acquire))
+    Write();
+}
+
+// Write everything queued so far with a single gathered write, must only be
+// called by the holder of writing_
+void ebbrt::Messenger::Session::Write() {
+  auto head = send_head_.exchange(nullptr, std::memory_order_acquire);
+  if (!head) {
+    writing_.store(false, std::memory_order_release);
+    // a sender may have queued a message after the exchange above but seen
+    // writing_ still set
+    if (send_head_.load(std::memory_order_acquire) &&
+        !writing_.exchange(true, std::memory_order_acquire))
+      Write();
+    return;
+  }
+
+  // the list is newest first, reverse it to preserve send order
+  SendNode* batch = nullptr;
+  while (head) {
+    auto next = head->next;
+    head->next = batch;
+    batch = head;
+    head = next;
+  }
 
+  std::vector<boost::asio::const_buffer> buffers;
+  for (auto node = batch; node; node = node->next) {
+    for (auto& b : *node->buf) {
+      if (b.Length())
+        buffers.emplace_back(b.Data(), b.Length());
+    }
+  }
+
+  auto self(shared_from_this());
   boost::asio::async_write(
-      socket_, IOBufToCBS(std::move(data)),
+      socket_, buffers,
       EventManager::WrapHandler(
-          [p, self](boost::system::error_code ec, std::size_t /*length*/) {
-            if (!ec) {
-              p->SetValue();
-              delete p;
+          [batch, self](boost::system::error_code ec, std::size_t /*length*/) {
+            auto node = batch;
+            while (node) {
+              if (!ec) {
+                node->promise.SetValue();
+              } else {
+                node->promise.SetException(std::make_exception_ptr(
+                    boost::system::system_error(ec)));
+              }
+              auto next = node->next;
+              delete node;
+              node = next;
             }
+            self->Write();
           }));
-  return ret;
 }
 
 void ebbrt::Messenger::Session::ReadHeader() {
@@ -182,17 +371,31 @@ void ebbrt::Messenger::Session::ReadMessage() {
       socket_, boost::asio::buffer(buf->MutData(), size),
       EventManager::WrapHandler([this, buf, size, self](
           const boost::system::error_code& ec, std::size_t /*length*/) {
-        if (!ec) {
+        if (ec) {
+          delete buf;
+          return;
+        }
+        if (header_.type_code == kMessengerControlCode) {
+          uint64_t bytes;
+          std::memcpy(&bytes, buf->Data(), sizeof(bytes));
+          delete buf;
+          Grant(bytes);
+        } else {
+          consumed_ += sizeof(Header) + size;
           auto& ref = GetMessagableRef(header_.id, header_.type_code);
           ref.ReceiveMessageInternal(
               NetworkId(socket_.remote_endpoint().address().to_v4()),
               std::unique_ptr<MutIOBuf>(buf));
+          if (consumed_ >= kCreditWindow / 4)
+            ReturnCredit();
         }
         ReadHeader();
       }));
 }
 
 ebbrt::Messenger::NetworkId ebbrt::Messenger::LocalNetworkId() {
+  if (!local_addr_.is_unspecified())
+    return NetworkId(local_addr_);
   auto net_addr = node_allocator->GetNetAddr();
   return NetworkId(boost::asio::ip::address_v4(net_addr));
 }
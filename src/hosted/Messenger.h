@@ -6,10 +6,12 @@
 #define HOSTED_SRC_INCLUDE_EBBRT_MESSENGER_H_
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <mutex>
 #include <string>
-#include <queue>
 #include <utility>
+#include <vector>
 
 #include <boost/asio.hpp>
 
@@ -17,7 +19,9 @@
 #include "../Future.h"
 #include "../IOBuf.h"
 #include "../StaticSharedEbb.h"
+#include "../UniqueIOBuf.h"
 #include "EbbRef.h"
+#include "ShmRing.h"
 #include "StaticIds.h"
 
 namespace ebbrt {
@@ -51,49 +55,196 @@ class Messenger : public StaticSharedEbb<Messenger> {
     friend class Messenger;
   };
 
+  // Messages held back on the connection to a peer for want of credit (or, on
+  // the shared memory transport, of ring space)
+  struct QueueStats {
+    size_t messages;
+    size_t bytes;
+    // may be negative after a message larger than the remaining credit
+    int64_t credit;
+  };
+
   static void ClassInit() {} // no class wide static initialization logic
-  
+
+  // EBBRT_MESSENGER_ADDRESS and EBBRT_MESSENGER_PORT pin the Messenger to an
+  // address and port. Peers are reached on our own port, so processes which
+  // talk to each other must use the same one, and several on one host can do
+  // so by each taking its own loopback address (e.g. 127.0.0.2).
   Messenger();
 
-  Future<void> Send(NetworkId to, EbbId id, uint64_t type_code,
+  // Each TCP connection may have at most kCreditWindow bytes of messages
+  // which the peer has not yet delivered, it returns credit as it does.
+  // Messages beyond that are held back and the returned future is only
+  // fulfilled once the message has been written.
+  Future<void> Send(NetworkId to, EbbId id, uint32_t type_code,
                     std::unique_ptr<IOBuf>&& data);
+  // Hosted sends are not corked, this exists so that code shared with the
+  // native side can flush unconditionally
+  Future<void> Flush(NetworkId to) { return MakeReadyFuture<void>(); }
   NetworkId LocalNetworkId();
   uint16_t GetPort();
+  // Whether new connections to processes on the same host may use the shared
+  // memory transport, on by default
+  void SetSharedMemory(bool enable);
+  QueueStats GetQueueStats(NetworkId nid);
 
  private:
+  static const constexpr int64_t kCreditWindow = 1 << 20;
+
   struct Header {
     uint64_t length;
-    uint64_t type_code;
     EbbId id;
+    uint32_t type_code;
   };
 
-  class Session : public std::enable_shared_from_this<Session> {
+  // A connection to a peer, over which messages (header included) are sent
+  class Transport {
+   public:
+    virtual ~Transport() {}
+    // May be called from any thread
+    virtual Future<void> Send(std::unique_ptr<IOBuf>&& data) = 0;
+    virtual QueueStats GetQueueStats() = 0;
+  };
+
+  class Session : public Transport,
+                  public std::enable_shared_from_this<Session> {
    public:
     explicit Session(boost::asio::ip::tcp::socket socket);
 
     void Start();
-    Future<void> Send(std::unique_ptr<IOBuf>&& data);
+    Future<void> Send(std::unique_ptr<IOBuf>&& data) override;
+    QueueStats GetQueueStats() override;
 
    private:
+    struct SendNode {
+      SendNode* next;
+      std::unique_ptr<IOBuf> buf;
+      Promise<void> promise;
+    };
+    struct Waiting {
+      std::unique_ptr<IOBuf> buf;
+      size_t len;
+      Promise<void> promise;
+    };
+
     void ReadHeader();
     void ReadMessage();
+    // Hand a message to the writer regardless of credit
+    void Enqueue(std::unique_ptr<IOBuf> buf, Promise<void> promise);
+    void Write();
+    void Grant(uint64_t bytes);
+    void ReturnCredit();
 
     Header header_;
     boost::asio::ip::tcp::socket socket_;
+    // Messages waiting to be written, pushed by senders in reverse order
+    std::atomic<SendNode*> send_head_{nullptr};
+    // Set while one sender is writing on behalf of all the others
+    std::atomic<bool> writing_{false};
+    // bytes we may send before the peer returns credit, and the messages
+    // waiting for it
+    std::mutex credit_lock_;
+    int64_t credit_{kCreditWindow};
+    std::deque<Waiting> waiting_;
+    size_t waiting_len_{0};
+    // bytes delivered since we last returned credit, only touched by the
+    // reading handlers
+    uint64_t consumed_{0};
+  };
+
+  // A connection to a process on the same host through a pair of ShmRings
+  // in a memfd. Each side waits on its own eventfd, which the peer signals
+  // both when it has written to the receive ring and when it has freed space
+  // in the send ring. The unix socket the descriptors were passed over stays
+  // open and silent, it reaching end of file is how we learn the peer is gone.
+  class ShmSession : public Transport,
+                     public std::enable_shared_from_this<ShmSession> {
+   public:
+    // Takes ownership of the descriptors. The connecting side sends on the
+    // first ring of the mapping and the accepting side on the second.
+    ShmSession(NetworkId peer, int memfd, bool accepted, int doorbell,
+               int peer_doorbell,
+               boost::asio::local::stream_protocol::socket control);
+    ~ShmSession();
+
+    void Start();
+    Future<void> Send(std::unique_ptr<IOBuf>&& data) override;
+    QueueStats GetQueueStats() override;
+
+   private:
+    struct Pending {
+      std::unique_ptr<IOBuf> buf;
+      Promise<void> promise;
+    };
+
+    static void* Map(int memfd);
+    void WaitDoorbell();
+    void WaitPeer();
+    // The peer has gone, fail what is waiting for ring space and stop
+    // receiving. The rings are unmapped once the last reference is dropped.
+    void Close();
+    void Receive();
+    // Copy pending messages into the send ring, must hold tx_lock_. Returns
+    // the promises of the messages which were written completely.
+    std::vector<Promise<void>> Transmit();
+    void Flush();
+    void Ring();
+
+    NetworkId peer_;
+    void* mem_;
+    ShmRing tx_;
+    ShmRing rx_;
+    boost::asio::posix::stream_descriptor doorbell_;
+    int peer_doorbell_;
+    uint64_t doorbell_count_;
+    boost::asio::local::stream_protocol::socket control_;
+    char control_byte_;
+    std::atomic<bool> closed_{false};
+
+    std::mutex tx_lock_;
+    std::deque<Pending> pending_;
+    // bytes of the front pending message already in the ring
+    size_t pending_offset_{0};
+
+    Header header_;
+    size_t header_read_{0};
+    std::unique_ptr<MutUniqueIOBuf> message_;
+    size_t message_read_{0};
   };
 
+  // Name of the abstract unix socket a Messenger on this host listens on,
+  // the address is left out unless the Messenger is pinned to one
+  static std::string ShmName(const boost::asio::ip::address_v4& addr,
+                             uint16_t port);
   void DoAccept(std::shared_ptr<boost::asio::ip::tcp::acceptor> acceptor,
                 std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+  void DoShmAccept(
+      std::shared_ptr<boost::asio::local::stream_protocol::acceptor> acceptor,
+      std::shared_ptr<boost::asio::local::stream_protocol::socket> socket);
+  void ShmHandshake(
+      std::shared_ptr<boost::asio::local::stream_protocol::socket> socket);
+  // Set up a shared memory session if to is a process on this host,
+  // otherwise returns nullptr
+  std::shared_ptr<Transport> ShmConnect(NetworkId to);
+  void Connect(NetworkId to);
+  void Connected(uint32_t ip, std::shared_ptr<Transport> session);
+  // Stop sending to ip over transport, if it is still the one we use
+  void Forget(uint32_t ip, Transport* transport);
 
   uint16_t port_;
+  // unspecified unless pinned
+  boost::asio::ip::address_v4 local_addr_;
+  std::atomic<bool> shm_enabled_{true};
   std::mutex m_;
-  std::unordered_map<uint32_t, SharedFuture<std::weak_ptr<Session>>>
+  std::unordered_map<uint32_t, SharedFuture<std::weak_ptr<Transport>>>
       connection_map_;
-  std::unordered_map<uint32_t, Promise<std::weak_ptr<Session>>> promise_map_;
+  std::unordered_map<uint32_t, Promise<std::weak_ptr<Transport>>> promise_map_;
   typedef std::pair<Promise<void>,std::unique_ptr<IOBuf>> message_queue_entry_t;
-  std::unordered_map<uint32_t, std::queue<message_queue_entry_t>> message_queue_;
+  std::unordered_map<uint32_t, std::deque<message_queue_entry_t>>
+      message_queue_;
 
   friend class Session;
+  friend class ShmSession;
   friend class NodeAllocator;
 };
 
@@ -0,0 +1,438 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// The shared memory transport. A Messenger listens on an abstract unix socket
+// named after its port (and address, if pinned to one), the same port peers
+// use to reach it over TCP. When sending to an address of this host, the
+// sender first tries that socket and, if someone is listening, creates the
+// rings and doorbells and passes the descriptors across. Otherwise it falls
+// back to TCP.
+
+#include "Messenger.h"
+#include "GlobalIdMap.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bai = boost::asio::ip;
+using boost::asio::local::stream_protocol;
+
+namespace {
+const constexpr size_t kShmMappingSize = 2 * ebbrt::ShmRing::kMappingSize;
+const constexpr size_t kShmFds = 3;
+
+bool IsLocalAddress(const bai::address_v4& addr) {
+  if (addr.is_loopback())
+    return true;
+
+  ifaddrs* ifs;
+  if (getifaddrs(&ifs) < 0)
+    return false;
+
+  auto found = false;
+  for (auto i = ifs; i && !found; i = i->ifa_next) {
+    if (!i->ifa_addr || i->ifa_addr->sa_family != AF_INET)
+      continue;
+    auto sin = reinterpret_cast<sockaddr_in*>(i->ifa_addr);
+    found = ntohl(sin->sin_addr.s_addr) == addr.to_ulong();
+  }
+  freeifaddrs(ifs);
+  return found;
+}
+
+std::exception_ptr PeerGone() {
+  return std::make_exception_ptr(
+      std::runtime_error("Messenger: shared memory peer went away"));
+}
+
+void CloseFds(const int (&fds)[kShmFds]) {
+  for (auto fd : fds) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+// Pass the sender's address along with the memfd and both doorbells
+bool SendFds(int sock, const std::string& addr, const int (&fds)[kShmFds]) {
+  iovec iov;
+  iov.iov_base = const_cast<char*>(addr.data());
+  iov.iov_len = addr.size();
+  char control[CMSG_SPACE(sizeof(fds))];
+  std::memset(control, 0, sizeof(control));
+
+  msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) ==
+         static_cast<ssize_t>(addr.size());
+}
+
+// Fails with errno EAGAIN if nothing has arrived yet, and EPROTO if what
+// arrived is not a handshake. The sender writes it all with one sendmsg.
+bool RecvFds(int sock, unsigned char (&addr)[4], int (&fds)[kShmFds]) {
+  iovec iov;
+  iov.iov_base = addr;
+  iov.iov_len = sizeof(addr);
+  char control[CMSG_SPACE(sizeof(fds))];
+
+  msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  auto len = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (len < 0)
+    return false;
+  errno = EPROTO;
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS)
+    return false;
+
+  auto n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+  std::memcpy(fds, CMSG_DATA(cmsg), std::min(n, kShmFds) * sizeof(int));
+  if (n != kShmFds || len != sizeof(addr) || (msg.msg_flags & MSG_CTRUNC)) {
+    if (n == kShmFds)
+      CloseFds(fds);
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+std::string ebbrt::Messenger::ShmName(const bai::address_v4& addr,
+                                      uint16_t port) {
+  // the leading nul puts the socket in the abstract namespace, so it needs
+  // no cleanup and is only reachable from this host
+  auto name = std::string("\0ebbrt-messenger-", 17) + std::to_string(port);
+  if (!addr.is_unspecified())
+    name += "-" + addr.to_string();
+  return name;
+}
+
+std::shared_ptr<ebbrt::Messenger::Transport>
+ebbrt::Messenger::ShmConnect(NetworkId to) {
+  if (!shm_enabled_ || !IsLocalAddress(to.ip_))
+    return nullptr;
+
+  // the peer may be pinned to the address we send to, or listen on all
+  auto sock = -1;
+  for (auto& name :
+       {ShmName(to.ip_, port_), ShmName(bai::address_v4(), port_)}) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, name.data(), name.size());
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+      return nullptr;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&addr),
+                offsetof(sockaddr_un, sun_path) + name.size()) == 0)
+      break;
+    close(sock);
+    sock = -1;
+  }
+  // nobody on this host listens on our port
+  if (sock < 0)
+    return nullptr;
+
+  int fds[kShmFds] = {memfd_create("ebbrt-messenger", MFD_CLOEXEC),
+                      eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK),
+                      eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)};
+  // Unless we are pinned to an address, the peer sees us at the address we
+  // are sending to, as it would as the source of a TCP connection
+  auto from = local_addr_.is_unspecified() ? to : NetworkId(local_addr_);
+  if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 ||
+      ftruncate(fds[0], kShmMappingSize) < 0 ||
+      !SendFds(sock, from.ToBytes(), fds)) {
+    CloseFds(fds);
+    close(sock);
+    return nullptr;
+  }
+  boost::asio::local::stream_protocol::socket control(
+      active_context->io_service_, boost::asio::local::stream_protocol(),
+      sock);
+  auto session = std::make_shared<ShmSession>(to, fds[0], false, fds[1],
+                                              fds[2], std::move(control));
+  session->Start();
+  return session;
+}
+
+void ebbrt::Messenger::DoShmAccept(
+    std::shared_ptr<stream_protocol::acceptor> acceptor,
+    std::shared_ptr<stream_protocol::socket> socket) {
+  acceptor->async_accept(*socket, EventManager::WrapHandler([acceptor, socket,
+                                                             this](
+                                      boost::system::error_code ec) {
+    if (ec)
+      return;
+
+    ShmHandshake(std::move(socket));
+    DoShmAccept(std::move(acceptor), std::make_shared<stream_protocol::socket>(
+                                         active_context->io_service_));
+  }));
+}
+
+// Wait for the connecting side's descriptors without blocking the context, a
+// process which connects and then sends nothing only holds on to its socket
+void ebbrt::Messenger::ShmHandshake(
+    std::shared_ptr<stream_protocol::socket> socket) {
+  socket->async_wait(
+      stream_protocol::socket::wait_read,
+      EventManager::WrapHandler([socket, this](boost::system::error_code ec) {
+        if (ec)
+          return;
+
+        unsigned char addr[4];
+        int fds[kShmFds];
+        if (!shm_enabled_) {
+          socket->close();
+          return;
+        }
+        if (!RecvFds(socket->native_handle(), addr, fds)) {
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            ShmHandshake(std::move(socket));
+          else
+            socket->close();
+          return;
+        }
+
+        auto peer = NetworkId::FromBytes(addr, sizeof(addr));
+        auto ip = peer.ip_.to_ulong();
+        auto session = std::make_shared<ShmSession>(
+            peer, fds[0], true, fds[2], fds[1], std::move(*socket));
+        session->Start();
+        // if we already have a connection to the peer it stays the one we
+        // send on, this session still receives
+        std::lock_guard<std::mutex> lock(m_);
+        connection_map_.emplace(
+            ip, MakeReadyFuture<std::weak_ptr<Transport>>(std::move(session))
+                    .Share());
+      }));
+}
+
+ebbrt::Messenger::ShmSession::ShmSession(NetworkId peer, int memfd,
+                                         bool accepted, int doorbell,
+                                         int peer_doorbell,
+                                         stream_protocol::socket control)
+    : peer_(std::move(peer)), mem_(Map(memfd)),
+      tx_(static_cast<uint8_t*>(mem_) +
+          (accepted ? ShmRing::kMappingSize : 0)),
+      rx_(static_cast<uint8_t*>(mem_) +
+          (accepted ? 0 : ShmRing::kMappingSize)),
+      doorbell_(active_context->io_service_, doorbell),
+      peer_doorbell_(peer_doorbell), control_(std::move(control)) {}
+
+ebbrt::Messenger::ShmSession::~ShmSession() {
+  munmap(mem_, kShmMappingSize);
+  close(peer_doorbell_);
+}
+
+void* ebbrt::Messenger::ShmSession::Map(int memfd) {
+  auto mem = mmap(nullptr, kShmMappingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, memfd, 0);
+  close(memfd);
+  if (mem == MAP_FAILED)
+    throw std::runtime_error("Messenger: failed to map shared memory ring");
+  return mem;
+}
+
+void ebbrt::Messenger::ShmSession::Start() {
+  WaitDoorbell();
+  WaitPeer();
+}
+
+ebbrt::Future<void>
+ebbrt::Messenger::ShmSession::Send(std::unique_ptr<IOBuf>&& data) {
+  Promise<void> promise;
+  auto ret = promise.GetFuture();
+  std::vector<Promise<void>> done;
+  {
+    std::lock_guard<std::mutex> lock(tx_lock_);
+    if (closed_)
+      return MakeFailedFuture<void>(PeerGone());
+    pending_.emplace_back(Pending{std::move(data), std::move(promise)});
+    done = Transmit();
+  }
+  for (auto& p : done)
+    p.SetValue();
+  return ret;
+}
+
+std::vector<ebbrt::Promise<void>> ebbrt::Messenger::ShmSession::Transmit() {
+  std::vector<Promise<void>> done;
+  auto wrote = false;
+  while (!pending_.empty()) {
+    auto& front = pending_.front();
+    auto skip = pending_offset_;
+    auto full = false;
+    for (auto& b : *front.buf) {
+      if (skip >= b.Length()) {
+        skip -= b.Length();
+        continue;
+      }
+      auto len = b.Length() - skip;
+      auto n = tx_.Write(b.Data() + skip, len);
+      pending_offset_ += n;
+      wrote |= n > 0;
+      skip = 0;
+      if (n < len) {
+        full = true;
+        break;
+      }
+    }
+    if (full) {
+      // The consumer may have emptied the ring before the flag was set, so
+      // try again once it is. If the flag was already set the consumer has
+      // yet to see it and will ring once it frees space.
+      auto& waiting = tx_.GetControl().producer_waiting;
+      if (waiting.exchange(true))
+        break;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      continue;
+    }
+    done.emplace_back(std::move(front.promise));
+    pending_.pop_front();
+    pending_offset_ = 0;
+  }
+  if (wrote)
+    Ring();
+  return done;
+}
+
+void ebbrt::Messenger::ShmSession::Flush() {
+  std::vector<Promise<void>> done;
+  {
+    std::lock_guard<std::mutex> lock(tx_lock_);
+    if (pending_.empty())
+      return;
+    done = Transmit();
+  }
+  for (auto& p : done)
+    p.SetValue();
+}
+
+// The ring is the window here, the credit is the space left in it
+ebbrt::Messenger::QueueStats ebbrt::Messenger::ShmSession::GetQueueStats() {
+  std::lock_guard<std::mutex> lock(tx_lock_);
+  QueueStats stats{pending_.size(), 0, static_cast<int64_t>(tx_.Free())};
+  for (auto& p : pending_)
+    stats.bytes += p.buf->ComputeChainDataLength();
+  stats.bytes -= pending_offset_;
+  return stats;
+}
+
+void ebbrt::Messenger::ShmSession::Ring() {
+  uint64_t one = 1;
+  // EAGAIN means the counter is saturated, so the peer is due to wake anyway
+  if (write(peer_doorbell_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    throw std::runtime_error("Messenger: failed to ring doorbell");
+}
+
+void ebbrt::Messenger::ShmSession::WaitDoorbell() {
+  auto self(shared_from_this());
+  doorbell_.async_read_some(
+      boost::asio::buffer(&doorbell_count_, sizeof(doorbell_count_)),
+      EventManager::WrapHandler([this, self](
+          const boost::system::error_code& ec, std::size_t /*length*/) {
+        if (ec)
+          return;
+        Receive();
+        // the peer may also have rung because it freed space for us
+        Flush();
+        WaitDoorbell();
+      }));
+}
+
+// The peer never writes to the control socket, so any completion means it
+// has closed its end (or broken the protocol)
+void ebbrt::Messenger::ShmSession::WaitPeer() {
+  auto self(shared_from_this());
+  control_.async_read_some(
+      boost::asio::buffer(&control_byte_, sizeof(control_byte_)),
+      EventManager::WrapHandler([this, self](
+          const boost::system::error_code& ec, std::size_t /*length*/) {
+        if (ec == boost::asio::error::operation_aborted)
+          return;
+        Close();
+      }));
+}
+
+void ebbrt::Messenger::ShmSession::Close() {
+  if (closed_.exchange(true))
+    return;
+
+  std::deque<Pending> pending;
+  {
+    std::lock_guard<std::mutex> lock(tx_lock_);
+    pending.swap(pending_);
+    pending_offset_ = 0;
+  }
+  for (auto& p : pending)
+    p.promise.SetException(PeerGone());
+
+  messenger->Forget(peer_.ip_.to_ulong(), this);
+  // our pending doorbell read completes with an error, dropping the session's
+  // own reference
+  boost::system::error_code ec;
+  doorbell_.close(ec);
+  control_.close(ec);
+}
+
+// Drain the receive ring, a message larger than what is in the ring is
+// gathered across several doorbells
+void ebbrt::Messenger::ShmSession::Receive() {
+  auto consumed = false;
+  while (true) {
+    if (header_read_ < sizeof(Header)) {
+      auto n = rx_.Read(reinterpret_cast<uint8_t*>(&header_) + header_read_,
+                        sizeof(Header) - header_read_);
+      header_read_ += n;
+      consumed |= n > 0;
+      if (header_read_ < sizeof(Header))
+        break;
+      message_ = MakeUniqueIOBuf(header_.length);
+      message_read_ = 0;
+    }
+    auto n = rx_.Read(message_->MutData() + message_read_,
+                      header_.length - message_read_);
+    message_read_ += n;
+    consumed |= n > 0;
+    if (message_read_ < header_.length)
+      break;
+
+    header_read_ = 0;
+    auto& ref = GetMessagableRef(header_.id, header_.type_code);
+    ref.ReceiveMessageInternal(peer_, std::move(message_));
+  }
+
+  if (consumed) {
+    // pairs with the fence in Transmit, either we see the flag or the
+    // producer sees the space we freed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (rx_.GetControl().producer_waiting.exchange(false))
+      Ring();
+  }
+}
@@ -0,0 +1,31 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "NetStats.h"
+
+#include "../UniqueIOBuf.h"
+#include "Messenger.h"
+
+EBBRT_PUBLISH_TYPE(ebbrt, NetStats);
+
+ebbrt::Future<ebbrt::NetCounters>
+ebbrt::NetStats::Query(Messenger::NetworkId nid) {
+  auto call = rpc_.Start<NetCounters>();
+  auto buf = MakeUniqueIOBuf(sizeof(NetStatsRequest));
+  auto& request = *reinterpret_cast<NetStatsRequest*>(buf->MutData());
+  request.id = call.id;
+  SendMessage(nid, std::move(buf));
+  return std::move(call.future);
+}
+
+// A native node replying with its counters
+void ebbrt::NetStats::ReceiveMessage(Messenger::NetworkId nid,
+                                     std::unique_ptr<IOBuf>&& buf) {
+  if (buf->ComputeChainDataLength() < sizeof(NetStatsReply))
+    return;
+
+  auto dp = buf->GetDataPointer();
+  const auto& reply = dp.Get<NetStatsReply>();
+  rpc_.Complete<NetCounters>(static_cast<uint32_t>(reply.id), reply.counters);
+}
@@ -0,0 +1,39 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef HOSTED_SRC_INCLUDE_EBBRT_NETSTATS_H_
+#define HOSTED_SRC_INCLUDE_EBBRT_NETSTATS_H_
+
+#include "../CacheAligned.h"
+#include "../Future.h"
+#include "../Message.h"
+#include "../NetCounters.h"
+#include "../Rpc.h"
+#include "../StaticSharedEbb.h"
+#include "EbbRef.h"
+#include "StaticIds.h"
+
+namespace ebbrt {
+// Frontend side of the network counters, which are kept by native nodes
+class NetStats : public StaticSharedEbb<NetStats>,
+                 public CacheAligned,
+                 public Messagable<NetStats> {
+ public:
+  static void ClassInit() {}  // no class wide static initialization logic
+
+  NetStats() : Messagable<NetStats>(kNetStatsId) {}
+
+  // Fetch the counters of a native node, summed across its cores
+  Future<NetCounters> Query(Messenger::NetworkId nid);
+
+  void ReceiveMessage(Messenger::NetworkId nid, std::unique_ptr<IOBuf>&& buf);
+
+ private:
+  RpcTable rpc_;
+};
+
+constexpr auto net_stats = EbbRef<NetStats>(kNetStatsId);
+}  // namespace ebbrt
+
+#endif  // HOSTED_SRC_INCLUDE_EBBRT_NETSTATS_H_
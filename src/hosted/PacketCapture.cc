@@ -0,0 +1,78 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "PacketCapture.h"
+
+#include "../UniqueIOBuf.h"
+#include "Messenger.h"
+
+EBBRT_PUBLISH_TYPE(ebbrt, PacketCapture);
+
+void ebbrt::PacketCapture::WriteHeader(std::ostream& out, uint32_t snap_len) {
+  pcap::FileHeader header;
+  header.magic = pcap::kMagic;
+  header.version_major = pcap::kVersionMajor;
+  header.version_minor = pcap::kVersionMinor;
+  header.thiszone = 0;
+  header.sigfigs = 0;
+  header.snaplen = snap_len;
+  header.network = pcap::kLinkTypeEthernet;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+ebbrt::Future<size_t>
+ebbrt::PacketCapture::Request(Messenger::NetworkId nid, CaptureRequest::Op op,
+                              const CaptureFilter& filter, std::ostream* out) {
+  auto call = rpc_.Start<std::unique_ptr<IOBuf>>();
+  auto buf = MakeUniqueIOBuf(sizeof(CaptureRequest));
+  auto& request = *reinterpret_cast<CaptureRequest*>(buf->MutData());
+  request.id = call.id;
+  request.op = op;
+  request.filter = filter;
+  SendMessage(nid, std::move(buf));
+  // the reply is handed back to the requesting core, which writes out any
+  // records it carries
+  return call.future.Then([this, out](Future<std::unique_ptr<IOBuf>> f) {
+    auto reply_buf = std::move(f.Get());
+    auto dp = reply_buf->GetDataPointer();
+    auto reply = dp.Get<CaptureReply>();
+    dropped_ = reply.dropped;
+    if (out) {
+      reply_buf->AdvanceChain(sizeof(CaptureReply));
+      for (auto& b : *reply_buf) {
+        out->write(reinterpret_cast<const char*>(b.Data()), b.Length());
+      }
+    }
+    return static_cast<size_t>(reply.count);
+  });
+}
+
+ebbrt::Future<void> ebbrt::PacketCapture::Start(Messenger::NetworkId nid,
+                                                const CaptureFilter& filter) {
+  return Request(nid, CaptureRequest::kStart, filter, nullptr)
+      .Then([](Future<size_t> f) { f.Get(); });
+}
+
+ebbrt::Future<void> ebbrt::PacketCapture::Stop(Messenger::NetworkId nid) {
+  return Request(nid, CaptureRequest::kStop, CaptureFilter(), nullptr)
+      .Then([](Future<size_t> f) { f.Get(); });
+}
+
+ebbrt::Future<size_t> ebbrt::PacketCapture::Drain(Messenger::NetworkId nid,
+                                                  std::ostream& out) {
+  return Request(nid, CaptureRequest::kDrain, CaptureFilter(), &out);
+}
+
+// A node replying to one of our requests, a drain reply carries the records
+// already laid out in pcap format
+void ebbrt::PacketCapture::ReceiveMessage(Messenger::NetworkId nid,
+                                          std::unique_ptr<IOBuf>&& buf) {
+  if (buf->ComputeChainDataLength() < sizeof(CaptureReply))
+    return;
+
+  auto dp = buf->GetDataPointer();
+  auto id = dp.Get<CaptureReply>().id;
+  rpc_.Complete<std::unique_ptr<IOBuf>>(static_cast<uint32_t>(id),
+                                        std::move(buf));
+}
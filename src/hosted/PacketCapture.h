@@ -0,0 +1,59 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef HOSTED_SRC_INCLUDE_EBBRT_PACKETCAPTURE_H_
+#define HOSTED_SRC_INCLUDE_EBBRT_PACKETCAPTURE_H_
+
+#include <atomic>
+#include <ostream>
+
+#include "../CacheAligned.h"
+#include "../Future.h"
+#include "../Message.h"
+#include "../Pcap.h"
+#include "../Rpc.h"
+#include "../StaticSharedEbb.h"
+#include "EbbRef.h"
+#include "StaticIds.h"
+
+namespace ebbrt {
+// Frontend side of packet capture on native nodes. A capture is streamed out
+// by writing a pcap file header with WriteHeader and then repeatedly calling
+// Drain, which appends whatever the node has captured since the last drain.
+class PacketCapture : public StaticSharedEbb<PacketCapture>,
+                      public CacheAligned,
+                      public Messagable<PacketCapture> {
+ public:
+  static void ClassInit() {}  // no class wide static initialization logic
+
+  PacketCapture() : Messagable<PacketCapture>(kPacketCaptureId) {}
+
+  static void WriteHeader(std::ostream& out,
+                          uint32_t snap_len = pcap::kMaxSnapLen);
+
+  Future<void> Start(Messenger::NetworkId nid,
+                     const CaptureFilter& filter = CaptureFilter());
+  Future<void> Stop(Messenger::NetworkId nid);
+  // Append records captured by the node to out, returns the number of
+  // records written. A drain returns a bounded batch, so more records may
+  // remain whenever it returns a non zero count.
+  Future<size_t> Drain(Messenger::NetworkId nid, std::ostream& out);
+  // Records the node has lost to full rings since capture began, as of the
+  // most recent reply
+  uint64_t Dropped() const { return dropped_; }
+
+  void ReceiveMessage(Messenger::NetworkId nid, std::unique_ptr<IOBuf>&& buf);
+
+ private:
+  Future<size_t> Request(Messenger::NetworkId nid, CaptureRequest::Op op,
+                         const CaptureFilter& filter, std::ostream* out);
+
+  RpcTable rpc_;
+  std::atomic<uint64_t> dropped_{0};
+};
+
+constexpr auto packet_capture = EbbRef<PacketCapture>(kPacketCaptureId);
+}  // namespace ebbrt
+
+#endif  // HOSTED_SRC_INCLUDE_EBBRT_PACKETCAPTURE_H_
@@ -0,0 +1,83 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef HOSTED_SRC_INCLUDE_EBBRT_SHMRING_H_
+#define HOSTED_SRC_INCLUDE_EBBRT_SHMRING_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "../CacheAligned.h"
+
+namespace ebbrt {
+// One direction of a byte stream between two processes, living in memory
+// that both have mapped. There is a single producer and a single consumer.
+// head and tail count every byte ever written and read so they never wrap,
+// and both sides only ever store to their own index.
+class ShmRing {
+ public:
+  static const constexpr size_t kSize = 1 << 22;
+
+  struct Control {
+    alignas(cache_size) std::atomic<uint64_t> head;
+    alignas(cache_size) std::atomic<uint64_t> tail;
+    // Set by a producer which stopped on a full ring, the consumer rings its
+    // doorbell after freeing space
+    alignas(cache_size) std::atomic<bool> producer_waiting;
+  };
+
+  // Bytes of shared memory backing a ring, the memory must start zeroed
+  static const constexpr size_t kMappingSize = sizeof(Control) + kSize;
+
+  explicit ShmRing(void* mem)
+      : ctrl_(*static_cast<Control*>(mem)),
+        data_(static_cast<uint8_t*>(mem) + sizeof(Control)) {}
+
+  Control& GetControl() { return ctrl_; }
+
+  // Bytes the producer could write right now
+  size_t Free() const {
+    auto head = ctrl_.head.load(std::memory_order_relaxed);
+    auto tail = ctrl_.tail.load(std::memory_order_acquire);
+    return kSize - static_cast<size_t>(head - tail);
+  }
+
+  // Copy in as much of src as fits, returns the number of bytes copied
+  size_t Write(const uint8_t* src, size_t len) {
+    auto head = ctrl_.head.load(std::memory_order_relaxed);
+    auto tail = ctrl_.tail.load(std::memory_order_acquire);
+    len = std::min(len, kSize - static_cast<size_t>(head - tail));
+    auto offset = head & (kSize - 1);
+    auto first = std::min(len, kSize - offset);
+    std::memcpy(data_ + offset, src, first);
+    std::memcpy(data_, src + first, len - first);
+    ctrl_.head.store(head + len, std::memory_order_release);
+    return len;
+  }
+
+  // Copy out up to len bytes, returns the number of bytes copied
+  size_t Read(uint8_t* dst, size_t len) {
+    auto tail = ctrl_.tail.load(std::memory_order_relaxed);
+    auto head = ctrl_.head.load(std::memory_order_acquire);
+    len = std::min(len, static_cast<size_t>(head - tail));
+    auto offset = tail & (kSize - 1);
+    auto first = std::min(len, kSize - offset);
+    std::memcpy(dst, data_ + offset, first);
+    std::memcpy(dst + first, data_, len - first);
+    ctrl_.tail.store(tail + len, std::memory_order_release);
+    return len;
+  }
+
+ private:
+  static_assert(kSize && !(kSize & (kSize - 1)),
+                "ring size must be a power of two");
+
+  Control& ctrl_;
+  uint8_t* data_;
+};
+}  // namespace ebbrt
+
+#endif  // HOSTED_SRC_INCLUDE_EBBRT_SHMRING_H_
@@ -23,11 +23,20 @@ void ebbrt::Timer::Start(Hook& hook, std::chrono::microseconds timeout,
       active_context->io_service_,
       boost::posix_time::microseconds(timeout.count()));
 
+  started_[&hook] = t;
   t->async_wait(EventManager::WrapHandler(
-      [&hook, t, repeat, timeout](const boost::system::error_code& e) {
+      [this, &hook, t, repeat, timeout](const boost::system::error_code& e) {
+        if (e == boost::asio::error::operation_aborted)
+          return;
         if (e) {
           ebbrt::kabort("ASIO Error: %d\n", e.value());
         }
+        // the hook may have been stopped (and started again) after this
+        // timer expired but before the handler ran
+        auto it = started_.find(&hook);
+        if (it == started_.end() || it->second != t)
+          return;
+        started_.erase(it);
         if (repeat) {
           timer->Start(hook, timeout, repeat);
         }
@@ -35,4 +44,10 @@ void ebbrt::Timer::Start(Hook& hook, std::chrono::microseconds timeout,
       }));
 }
 
-void ebbrt::Timer::Stop(Hook& hook) { EBBRT_UNIMPLEMENTED(); }
+void ebbrt::Timer::Stop(Hook& hook) {
+  auto it = started_.find(&hook);
+  if (it == started_.end())
+    return;
+  it->second->cancel();
+  started_.erase(it);
+}
@@ -0,0 +1,50 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "EphemeralPorts.h"
+
+#include <boost/functional/hash.hpp>
+
+#include "Random.h"
+
+ebbrt::EphemeralPorts::EphemeralPorts(
+    EbbRef<SharedPoolAllocator<uint16_t>> pool)
+    : pool_(pool), secret_(random::Get()) {}
+
+boost::optional<uint16_t> ebbrt::EphemeralPorts::Allocate() {
+  auto& ports = cores_[Cpu::GetMine()].exclusive;
+  if (ports.empty() && !Refill(ports))
+    return boost::optional<uint16_t>();
+
+  auto port = ports.back();
+  ports.pop_back();
+  return port;
+}
+
+void ebbrt::EphemeralPorts::Free(uint16_t port) {
+  auto& ports = cores_[Cpu::GetMine()].exclusive;
+  ports.push_back(port);
+  // Keep one batch cached, give the rest back so other cores can use them
+  if (ports.size() >= 2 * kBatch) {
+    pool_->FreeBatch(&ports[kBatch], ports.size() - kBatch);
+    ports.resize(kBatch);
+  }
+}
+
+// Keyed so that the ports chosen for a destination are not predictable
+// from outside (RFC 6056)
+size_t ebbrt::EphemeralPorts::Hash(Ipv4Address addr, uint16_t port) const {
+  size_t seed = secret_;
+  boost::hash_combine(seed, addr.toU32());
+  boost::hash_combine(seed, port);
+  return seed;
+}
+
+bool ebbrt::EphemeralPorts::Refill(std::vector<uint16_t>& ports) {
+  auto n = ports.size();
+  ports.resize(n + kBatch);
+  auto count = pool_->AllocateBatch(&ports[n], kBatch);
+  ports.resize(n + count);
+  return count > 0;
+}
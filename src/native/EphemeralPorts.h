@@ -0,0 +1,78 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef BAREMETAL_SRC_INCLUDE_EBBRT_EPHEMERALPORTS_H_
+#define BAREMETAL_SRC_INCLUDE_EBBRT_EPHEMERALPORTS_H_
+
+#include <array>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+#include "../CacheAligned.h"
+#include "Cpu.h"
+#include "NetIpAddress.h"
+#include "SharedPoolAllocator.h"
+
+namespace ebbrt {
+// Per-core caches of ephemeral ports in front of a SharedPoolAllocator. Each
+// core takes ports from the shared pool kBatch at a time, so the pool lock is
+// only touched on refill and spill rather than on every allocation.
+//
+// Allocate/Free hand out ports exclusively, for bindings with no remote end
+// (UDP, listening TCP). Select picks a port for a connection to a given
+// destination: ports in a core's connect cache are shared by all of its
+// connections, and a keyed hash of the destination picks where to start
+// probing, so many connections to different peers can use the same port.
+// A port is only ever in one core's connect cache, so the caller's in_use
+// check cannot race with another core choosing the same 4-tuple.
+class EphemeralPorts {
+ public:
+  static const constexpr size_t kBatch = 64;
+
+  explicit EphemeralPorts(EbbRef<SharedPoolAllocator<uint16_t>> pool);
+
+  boost::optional<uint16_t> Allocate();
+  // May be called on any core, the port joins that core's cache
+  void Free(uint16_t port);
+
+  template <typename F>
+  boost::optional<uint16_t> Select(Ipv4Address addr, uint16_t port,
+                                   F in_use) {
+    auto& core = cores_[Cpu::GetMine()];
+    auto& ports = core.connect;
+    auto offset = Hash(addr, port) + core.next_connect++;
+    auto n = ports.size();
+    for (size_t i = 0; i < n; ++i) {
+      auto candidate = ports[(offset + i) % n];
+      if (!in_use(candidate))
+        return candidate;
+    }
+    // every cached port is in use towards this destination, take more
+    while (Refill(ports)) {
+      for (; n < ports.size(); ++n) {
+        if (!in_use(ports[n]))
+          return ports[n];
+      }
+    }
+    return boost::optional<uint16_t>();
+  }
+
+ private:
+  struct alignas(cache_size) Core {
+    std::vector<uint16_t> exclusive;
+    std::vector<uint16_t> connect;
+    size_t next_connect{0};
+  };
+
+  size_t Hash(Ipv4Address addr, uint16_t port) const;
+  bool Refill(std::vector<uint16_t>& ports);
+
+  EbbRef<SharedPoolAllocator<uint16_t>> pool_;
+  size_t secret_;
+  std::array<Core, Cpu::kMaxCpus> cores_;
+};
+}  // namespace ebbrt
+
+#endif  // BAREMETAL_SRC_INCLUDE_EBBRT_EPHEMERALPORTS_H_
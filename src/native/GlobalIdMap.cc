@@ -29,26 +29,23 @@ void ebbrt::InstallGlobalIdMap(){
 }
 
 ebbrt::DefaultGlobalIdMap::DefaultGlobalIdMap()
-    : Messagable<DefaultGlobalIdMap>(kGlobalIdMapId), val_(0) { }
+    : Messagable<DefaultGlobalIdMap>(kGlobalIdMapId) { }
 
 void ebbrt::DefaultGlobalIdMap::SetAddress(uint32_t addr) { 
   frontend_ip = addr; }
 
 ebbrt::Future<std::string> ebbrt::DefaultGlobalIdMap::Get(EbbId id, const OptArgs& args) {
-  lock_.lock();
-  auto v = val_++;
-  auto& p = map_[v];
-  lock_.unlock();
+  auto call = rpc_.Start<std::string>();
 
   IOBufMessageBuilder message;
   auto builder = message.initRoot<global_id_map_message::Request>();
   auto get_builder = builder.initGetRequest();
-  get_builder.setMessageId(v);
+  get_builder.setMessageId(call.id);
   get_builder.setEbbId(id);
 
   SendMessage(Messenger::NetworkId(frontend_ip), AppendHeader(message));
 
-  return p.GetFuture();
+  return std::move(call.future);
 }
 
 ebbrt::Future<void> ebbrt::DefaultGlobalIdMap::Set(EbbId id, const OptArgs& args) {
@@ -64,11 +61,9 @@ void ebbrt::DefaultGlobalIdMap::ReceiveMessage(Messenger::NetworkId nid,
   switch (reply.which()) {
   case global_id_map_message::Reply::Which::GET_REPLY: {
     auto get_reply = reply.getGetReply();
-    auto mid = get_reply.getMessageId();
-    auto it = map_.find(mid);
-    kassert(it != map_.end());
     auto data = get_reply.getData();
-    it->second.SetValue(
+    rpc_.Complete<std::string>(
+        get_reply.getMessageId(),
         std::string(reinterpret_cast<const char*>(data.begin()), data.size()));
     break;
   }
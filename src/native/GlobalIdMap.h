@@ -13,6 +13,7 @@
 #include "../Future.h"
 #include "../GlobalIdMapBase.h"
 #include "../Message.h"
+#include "../Rpc.h"
 #include "../StaticSharedEbb.h"
 #include "EbbRef.h"
 #include "Runtime.h"
@@ -64,9 +65,7 @@ class DefaultGlobalIdMap : public GlobalIdMap,
   static void SetAddress(uint32_t addr);
 
  private:
-  ebbrt::SpinLock lock_;
-  std::unordered_map<uint64_t, Promise<std::string>> map_;
-  uint64_t val_;
+  RpcTable rpc_;
 };
 
 constexpr auto global_id_map = EbbRef<DefaultGlobalIdMap>(kGlobalIdMapId);
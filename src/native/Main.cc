@@ -28,6 +28,7 @@
 #include "Multiboot.h"
 #ifdef __EBBRT_ENABLE_NETWORKING__
 #include "Net.h"
+#include "NetTcpPacer.h"
 #endif
 #include "Numa.h"
 #include "PageAllocator.h"
@@ -148,6 +149,7 @@ ebbrt::Main(multiboot::Information* mbi) {
         event_manager->ReceiveToken();
 #ifdef __EBBRT_ENABLE_NETWORKING__
         NetworkManager::Init();
+        TcpPacer::Init();
         pci::Init();
         pci::RegisterProbe(VirtioNetDriver::Probe);
         pci::LoadDrivers();
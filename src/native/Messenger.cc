@@ -16,136 +16,133 @@ ebbrt::Messenger::Messenger() {}
 ebbrt::Messenger::Connection::Connection(ebbrt::NetworkManager::TcpPcb pcb)
     : TcpHandler(std::move(pcb)) {}
 
-void ebbrt::Messenger::Connection::check_preallocate() {
-  // preallocate buffer if payload occupancy ratio drops below threshold
-  size_t capacity = 0;
-  for (auto& buf : *buf_) {
-    capacity += buf.Capacity();
-  }
-  auto buffer_len = buf_->ComputeChainDataLength();
-  if (buffer_len < sizeof(Header))
-    return;
-  auto dp = buf_->GetDataPointer();
-  auto& header = dp.Get<Header>();
-  uint64_t message_len = sizeof(Header) + header.length;
-  if(message_len > 1<<30){
-    kabort("Messenger: ERROR Huge message requested \n");
-  }
-  auto ratio = static_cast<double>(buffer_len) / static_cast<double>(capacity);
-  if (ratio < kOccupancyRatio) {
-    // allocate message buffer and coalesce chain
-    auto newbuf = MakeUniqueIOBuf(message_len, false);
-    auto dp = newbuf->GetMutDataPointer();
-    for (auto& buf : *buf_) {
-      auto len = buf.Length();
-      std::memcpy(static_cast<void*>(dp.Data()), buf.Data(), len);
-      dp.Advance(len);
-      preallocate_ += len;
-    }
-    assert(newbuf->CountChainElements() == 1);
-    assert(newbuf->ComputeChainDataLength() == message_len);
-    assert(preallocate_ == buffer_len);
-    buf_ = std::move(newbuf);
-  }
-}
-
-void ebbrt::Messenger::Connection::preallocated(std::unique_ptr<MutIOBuf> b) {
-  auto dp = buf_->GetMutDataPointer();
-  auto& header = dp.GetNoAdvance<Header>();
-  auto message_len = sizeof(Header) + header.length;
-  dp.Advance(preallocate_);
-  for (auto& link : *b) {
-    auto len = link.Length();
-    std::memcpy(static_cast<void*>(dp.Data()), link.Data(), len);
-    dp.Advance(len);
-    preallocate_ += len;
-  }
-  if (preallocate_ == message_len) {
-    kassert(buf_->Length() == message_len);
-    preallocate_ = 0;
-    process_message(std::move(buf_));
-  }
-  return;
-}
-
 void ebbrt::Messenger::Connection::process_message(
     std::unique_ptr<MutIOBuf> b) {
   auto dp = b->GetDataPointer();
   // TODO(dschatz): get rid of datapointer
   auto& header = dp.Get<Header>();
+  if (header.type_code == kMessengerControlCode) {
+    Grant(dp.Get<uint64_t>());
+    return;
+  }
+
+  consumed_ += sizeof(Header) + header.length;
   b->AdvanceChain(sizeof(Header));
   auto& ref = GetMessagableRef(header.id, header.type_code);
   ref.ReceiveMessageInternal(NetworkId(Pcb().GetRemoteAddress()), std::move(b));
-  return;
+  if (consumed_ >= kCreditWindow / 4)
+    ReturnCredit();
 }
-std::unique_ptr<ebbrt::MutIOBuf>
-ebbrt::Messenger::Connection::process_message_chain(
-    std::unique_ptr<MutIOBuf> b) {
 
-  auto dp = b->GetDataPointer();
-  auto& header = dp.Get<Header>();
-  auto message_len = sizeof(Header) + header.length;
-
-  // Our buffer contains the data of multiple messages. We need to
-  // split the buffer at the first messsage boundary and preserve
-  // the rest.
-  auto orig_len = b->ComputeChainDataLength();
-  std::unique_ptr<IOBuf> tail_chain;
-  std::unique_ptr<IOBuf> split;
-  uint32_t length = 0;
-  // check if message is contained within first buffer
-  if (b->Length() >= message_len) {
-    length = b->Length();
-    split = std::move(b);
-    tail_chain = split->Pop();
-    b = nullptr;
-  } else {
-    for (auto& buf : *b) {
-      length += buf.Length();
-      if (length >= message_len) {
-        kassert(b->IsChained());
-        auto tmp = static_cast<MutIOBuf*>(b->UnlinkEnd(buf).release());
-        split = std::unique_ptr<MutIOBuf>(tmp);
-        tail_chain = split->Pop();
-        break;
-      }
+// Tell the peer it may send as many bytes again as we have delivered. Control
+// messages are not charged against credit themselves.
+void ebbrt::Messenger::Connection::ReturnCredit() {
+  auto buf = MakeUniqueIOBuf(sizeof(Header) + sizeof(uint64_t));
+  auto dp = buf->GetMutDataPointer();
+  auto& h = dp.Get<Header>();
+  h.length = sizeof(uint64_t);
+  h.id = 0;
+  h.type_code = kMessengerControlCode;
+  dp.Get<uint64_t>() = consumed_;
+  consumed_ = 0;
+
+  std::lock_guard<ebbrt::SpinLock> guard(cork_lock_);
+  Cork(std::move(buf));
+}
+
+// Credit returned by the peer, release whatever now fits
+void ebbrt::Messenger::Connection::Grant(uint64_t bytes) {
+  std::vector<Promise<void>> corked;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(cork_lock_);
+    credit_ += bytes;
+    while (!waiting_.empty() && credit_ > 0) {
+      auto& w = waiting_.front();
+      credit_ -= w.len;
+      waiting_len_ -= w.len;
+      Cork(std::move(w.buf));
+      corked.emplace_back(std::move(w.promise));
+      waiting_.pop_front();
     }
   }
-  // we "divide" the buffer by clone and resize
-  auto left_shard_len = split->Length() - (length - message_len);
-  auto right_shard_len = split->Length() - left_shard_len;
-  auto split_c = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
-                                                  std::move(split));
-  auto remainder =
-      IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView, *split_c);
-  split_c->TrimEnd(right_shard_len);
-  remainder->Advance(left_shard_len);
-
-  // combined data
-  if (!b) {
-    b = std::move(split_c);
+  for (auto& p : corked)
+    p.SetValue();
+}
+
+// Detach the message at the front of buf_, leaving the data that follows it
+// in buf_. Received buffers are never copied: the chain is cut between
+// buffers, and a buffer holding the end of one message and the start of the
+// next is shared by both through a MutSharedIOBufRef, which later splits of
+// the same buffer reuse rather than wrap again.
+std::unique_ptr<ebbrt::MutIOBuf>
+ebbrt::Messenger::Connection::split_message() {
+  kassert(buf_len_ > message_len_);
+  size_t length = 0;
+  MutIOBuf* split = nullptr;
+  for (auto& buf : *buf_) {
+    length += buf.Length();
+    if (length >= message_len_) {
+      split = &buf;
+      break;
+    }
+  }
+  kassert(split);
+  auto tail_len = length - message_len_;
+
+  std::unique_ptr<MutIOBuf> message;
+  std::unique_ptr<MutIOBuf> rest;
+  if (tail_len == 0) {
+    // the message ends with a buffer, cut the chain after it
+    rest = std::unique_ptr<MutIOBuf>(
+        static_cast<MutIOBuf*>(buf_->UnlinkEnd(*split->Next()).release()));
+    message = std::move(buf_);
+    buf_ = std::move(rest);
+    head_shared_ = false;
+    return message;
+  }
+
+  // the message ends within split, detach it from the chain
+  bool shared = head_shared_ && split == buf_.get();
+  std::unique_ptr<MutIOBuf> piece;
+  if (split == buf_.get()) {
+    piece = std::move(buf_);
   } else {
-    b->PrependChain(std::move(split_c));
+    piece = std::unique_ptr<MutIOBuf>(
+        static_cast<MutIOBuf*>(buf_->UnlinkEnd(*split).release()));
+    message = std::move(buf_);
   }
-  if (tail_chain) {
-    remainder->PrependChain(std::move(tail_chain));
+  rest = std::unique_ptr<MutIOBuf>(
+      static_cast<MutIOBuf*>(piece->Pop().release()));
+
+  std::unique_ptr<MutSharedIOBufRef> front;
+  if (shared) {
+    front = std::unique_ptr<MutSharedIOBufRef>(
+        static_cast<MutSharedIOBufRef*>(piece.release()));
+  } else {
+    front = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
+                                             std::move(piece));
   }
-  kassert(orig_len ==
-          (b->ComputeChainDataLength() + remainder->ComputeChainDataLength()));
+  auto back =
+      IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView, *front);
+  front->TrimEnd(tail_len);
+  back->Advance(front->Length());
 
-  process_message(std::move(b));
-  return std::move(remainder);
+  if (message) {
+    message->PrependChain(std::move(front));
+  } else {
+    message = std::move(front);
+  }
+  if (rest)
+    back->PrependChain(std::move(rest));
+  buf_ = std::move(back);
+  head_shared_ = true;
+  return message;
 }
 
 void ebbrt::Messenger::Connection::Receive(std::unique_ptr<MutIOBuf> b) {
   kassert(b->Length() != 0);
 
-  // check if we've preallocated a message buffer
-  if (preallocate_) {
-    preallocated(std::move(b));
-    return;
-  }
-  // otherwise, process buffer chain
+  buf_len_ += b->ComputeChainDataLength();
   if (buf_) {
     buf_->PrependChain(std::move(b));
   } else {
@@ -153,29 +150,104 @@ void ebbrt::Messenger::Connection::Receive(std::unique_ptr<MutIOBuf> b) {
   }
 
   while (buf_) {
-    auto buffer_len = buf_->ComputeChainDataLength();
-    if (buffer_len < sizeof(Header)) {
-      return;
+    if (!message_len_) {
+      if (buf_len_ < sizeof(Header))
+        return;
+      auto dp = buf_->GetDataPointer();
+      auto& header = dp.Get<Header>();
+      message_len_ = sizeof(Header) + header.length;
+      if (message_len_ > 1 << 30)
+        kabort("Messenger: ERROR Huge message requested \n");
     }
-    auto dp = buf_->GetDataPointer();
-    auto& header = dp.Get<Header>();
-    auto message_len = sizeof(Header) + header.length;
-    if (likely(buffer_len == message_len)) {
-      process_message(std::move(buf_));
-      return;
-    } else if (buffer_len < message_len) {
-      // check if we need to preallocate
-      // only  do this check at certain chain lengths
-      if (buf_->CountChainElements() % kPreallocateChainLen == 0) {
-        check_preallocate();
-      }
+    if (buf_len_ < message_len_)
       return;
-    } else if (buffer_len > message_len) {
-      // process message from chain and return remaining data
-      buf_ = process_message_chain(std::move(buf_));
+
+    std::unique_ptr<MutIOBuf> message;
+    if (buf_len_ == message_len_) {
+      message = std::move(buf_);
+      head_shared_ = false;
+    } else {
+      message = split_message();
     }
+    buf_len_ -= message_len_;
+    message_len_ = 0;
+    process_message(std::move(message));
   }
-  return;
+}
+
+// Charge a framed message against the peer's credit and cork it, or hold it
+// back until enough credit is returned. A message is let through whenever
+// some credit remains, so one larger than the window cannot stall forever.
+ebbrt::Future<void>
+ebbrt::Messenger::Connection::Queue(std::unique_ptr<IOBuf> b) {
+  auto len = b->ComputeChainDataLength();
+  std::lock_guard<ebbrt::SpinLock> guard(cork_lock_);
+  if (waiting_.empty() && credit_ > 0) {
+    credit_ -= len;
+    Cork(std::move(b));
+    return MakeReadyFuture<void>();
+  }
+
+  Promise<void> promise;
+  auto ret = promise.GetFuture();
+  waiting_len_ += len;
+  waiting_.emplace_back(Waiting{std::move(b), len, std::move(promise)});
+  return ret;
+}
+
+void ebbrt::Messenger::Connection::AddQueueStats(QueueStats& stats) {
+  std::lock_guard<ebbrt::SpinLock> guard(cork_lock_);
+  stats.messages += waiting_.size();
+  stats.bytes += waiting_len_;
+  stats.credit += credit_;
+}
+
+// Queue a framed message behind any others sent during this event, must be
+// called with cork_lock_ held. The first message corked arranges for the
+// flush.
+void ebbrt::Messenger::Connection::Cork(std::unique_ptr<IOBuf> b) {
+  corked_len_ += b->ComputeChainDataLength();
+  if (corked_) {
+    corked_->PrependChain(std::move(b));
+  } else {
+    corked_ = std::move(b);
+  }
+  if (corked_len_ >= kCorkMaxBytes) {
+    Push();
+    return;
+  }
+  if (flush_pending_)
+    return;
+
+  flush_pending_ = true;
+  auto window = messenger->cork_window_;
+  if (window.count() == 0) {
+    event_manager->SpawnLocal([this]() { Flush(/* scheduled = */ true); },
+                              /* force_async = */ true);
+  } else {
+    timer->Start(*this, window, /* repeat = */ false);
+  }
+}
+
+// Only the scheduled flush clears flush_pending_, so the timer hook is never
+// started again while it is still armed
+void ebbrt::Messenger::Connection::Flush(bool scheduled) {
+  std::lock_guard<ebbrt::SpinLock> guard(cork_lock_);
+  if (scheduled)
+    flush_pending_ = false;
+  Push();
+}
+
+void ebbrt::Messenger::Connection::Fire() { Flush(/* scheduled = */ true); }
+
+// Send the corked messages as one chain, must be called with cork_lock_ held
+void ebbrt::Messenger::Connection::Push() {
+  if (!corked_)
+    return;
+
+  corked_len_ = 0;
+  Send(std::move(corked_));
+  Pcb().Output();
 }
 
 void ebbrt::Messenger::Connection::Connected() { promise_.SetValue(this); }
@@ -198,14 +270,13 @@ void ebbrt::Messenger::StartListening(uint16_t port) {
   port_ = port;
   listening_pcb_.Bind(port, [this](NetworkManager::TcpPcb pcb) {
     auto addr = pcb.GetRemoteAddress();
-    std::lock_guard<ebbrt::SpinLock> lock(lock_);
-    if (connection_map_.find(addr) != connection_map_.end())
-      throw std::runtime_error("Store to promise");
-
     auto connection = new Connection(std::move(pcb));
     connection->Install();
-    connection_map_.emplace(addr,
-                            MakeReadyFuture<Connection*>(connection).Share());
+    // The peer may open several connections to us, each can carry our
+    // messages back as well
+    std::lock_guard<ebbrt::SpinLock> lock(lock_);
+    connection_map_[addr].emplace_back(
+        MakeReadyFuture<Connection*>(connection).Share());
   });
 }
 
@@ -214,23 +285,8 @@ ebbrt::Messenger::NetworkId ebbrt::Messenger::LocalNetworkId() {
 }
 
 ebbrt::Future<void> ebbrt::Messenger::Send(NetworkId to, EbbId id,
-                                           uint64_t type_code,
+                                           uint32_t type_code,
                                            std::unique_ptr<IOBuf>&& data) {
-  // make sure we have a pending connection
-  {
-    std::lock_guard<SpinLock> lock(lock_);
-    auto it = connection_map_.find(to.ip);
-    if (it == connection_map_.end()) {
-      // we don't have a pending connection, start one
-      NetworkManager::TcpPcb pcb;
-      pcb.Connect(to.ip, port_);
-      auto connection = new Connection(std::move(pcb));
-      connection->Install();
-      auto f = connection->GetFuture();
-      connection_map_.emplace(to.ip, connection->GetFuture().Share());
-    }
-  }
-
   // construct header
   auto buf = MakeUniqueIOBuf(sizeof(Header));
   auto dp = buf->GetMutDataPointer();
@@ -241,9 +297,80 @@ ebbrt::Future<void> ebbrt::Messenger::Send(NetworkId to, EbbId id,
   // Cast to non const is ok because we then take the whole chain as const
   buf->PrependChain(std::move(data));
 
-  return connection_map_[to.ip].Then([data = std::move(buf)](
+  return GetConnection(to.ip).Then([data = std::move(buf)](
       SharedFuture<Connection*> f) mutable {
-    f.Get()->Send(std::move(data));
-    f.Get()->Pcb().Output();
+    return f.Get()->Queue(std::move(data));
   });
 }
+
+// Each core sends to a peer over one connection, its stripe, so messages from
+// a core arrive in the order they were sent. Cores sharing a stripe are
+// serialized by the connection's cork lock.
+ebbrt::SharedFuture<ebbrt::Messenger::Connection*>&
+ebbrt::Messenger::GetConnection(Ipv4Address ip) {
+  auto& cache = core_connections_[Cpu::GetMine()].map;
+  auto it = cache.find(ip);
+  if (likely(it != cache.end()))
+    return it->second;
+
+  SharedFuture<Connection*> f;
+  {
+    std::lock_guard<SpinLock> lock(lock_);
+    auto& connections = connection_map_[ip];
+    auto stripes = stripes_ ? stripes_ : Cpu::Count();
+    auto stripe = Cpu::GetMine() % stripes;
+    if (stripe >= connections.size()) {
+      // we don't have enough connections yet, start one
+      NetworkManager::TcpPcb pcb;
+      pcb.Connect(ip, port_);
+      auto connection = new Connection(std::move(pcb));
+      connection->Install();
+      connections.emplace_back(connection->GetFuture().Share());
+      stripe = connections.size() - 1;
+    }
+    f = connections[stripe];
+  }
+  return cache.emplace(ip, std::move(f)).first->second;
+}
+
+ebbrt::Future<void> ebbrt::Messenger::Flush(NetworkId to) {
+  std::vector<SharedFuture<Connection*>> connections;
+  {
+    std::lock_guard<SpinLock> lock(lock_);
+    auto it = connection_map_.find(to.ip);
+    if (it == connection_map_.end())
+      return MakeReadyFuture<void>();
+    connections = it->second;
+  }
+  std::vector<Future<int>> flushed;
+  for (auto& connection : connections) {
+    flushed.emplace_back(connection.Then([](SharedFuture<Connection*> f) {
+      f.Get()->Flush();
+      return 0;
+    }));
+  }
+  return when_all(flushed).Then([](Future<std::vector<int>> f) { f.Get(); });
+}
+
+// Hold messages for up to window before sending them, 0 (the default) sends
+// at the end of each event
+void ebbrt::Messenger::SetCorkWindow(std::chrono::microseconds window) {
+  cork_window_ = window;
+}
+
+void ebbrt::Messenger::SetStripes(size_t stripes) { stripes_ = stripes; }
+
+// Summed over the connections to nid which have been established
+ebbrt::Messenger::QueueStats ebbrt::Messenger::GetQueueStats(NetworkId nid) {
+  QueueStats stats{0, 0, 0};
+  std::lock_guard<SpinLock> lock(lock_);
+  auto it = connection_map_.find(nid.ip);
+  if (it == connection_map_.end())
+    return stats;
+
+  for (auto& connection : it->second) {
+    if (connection.Ready())
+      connection.Get()->AddQueueStats(stats);
+  }
+  return stats;
+}
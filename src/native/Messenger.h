@@ -5,12 +5,18 @@
 #ifndef BAREMETAL_SRC_INCLUDE_EBBRT_MESSENGER_H_
 #define BAREMETAL_SRC_INCLUDE_EBBRT_MESSENGER_H_
 
+#include <array>
+#include <chrono>
+#include <deque>
 #include <string>
+#include <vector>
 
 #include "../CacheAligned.h"
 #include "../Future.h"
 #include "../SpinLock.h"
 #include "../StaticSharedEbb.h"
+#include "../Timer.h"
+#include "Cpu.h"
 #include "NetTcpHandler.h"
 #include "Runtime.h"
 #include "StaticIds.h"
@@ -21,8 +27,8 @@ class Messenger : public StaticSharedEbb<Messenger>, public CacheAligned {
  public:
   struct Header {
     uint64_t length;
-    uint64_t type_code;
     EbbId id;
+    uint32_t type_code;
   };
 
   class NetworkId {
@@ -64,13 +70,35 @@ class Messenger : public StaticSharedEbb<Messenger>, public CacheAligned {
     friend class Messenger;
   };
 
+  // Messages held back on the connections to a peer for want of credit
+  struct QueueStats {
+    size_t messages;
+    size_t bytes;
+    // may be negative after a message larger than the remaining credit
+    int64_t credit;
+  };
+
   static void ClassInit() {} // no class wide static initialization logic
   
   Messenger();
 
-  Future<void> Send(NetworkId nid, EbbId id, uint64_t type_code,
+  // Messages are corked per connection and handed to tcp together at the end
+  // of the sending event, or once the cork window expires if one is set.
+  //
+  // Each connection may have at most kCreditWindow bytes of messages which
+  // the peer has not yet delivered, it returns credit as it does. Messages
+  // beyond that are held back and the returned future is only fulfilled once
+  // the message has been corked, so producers can wait on it.
+  Future<void> Send(NetworkId nid, EbbId id, uint32_t type_code,
                     std::unique_ptr<IOBuf>&& data);
+  // Send anything corked for nid immediately, for latency critical callers
+  Future<void> Flush(NetworkId nid);
+  void SetCorkWindow(std::chrono::microseconds window);
+  // Number of connections kept to each peer, 0 (the default) for one per
+  // core. Only affects cores which have not yet sent to a peer.
+  void SetStripes(size_t stripes);
   void Receive(NetworkManager::TcpPcb& t, std::unique_ptr<IOBuf>&& b);
+  QueueStats GetQueueStats(NetworkId nid);
 
   NetworkId LocalNetworkId();
   uint16_t GetPort();
@@ -78,7 +106,7 @@ class Messenger : public StaticSharedEbb<Messenger>, public CacheAligned {
   void StartListening(uint16_t port);
 
  private:
-  class Connection : public TcpHandler {
+  class Connection : public TcpHandler, public Timer::Hook {
    public:
     explicit Connection(NetworkManager::TcpPcb pcb);
 
@@ -86,26 +114,68 @@ class Messenger : public StaticSharedEbb<Messenger>, public CacheAligned {
     void Connected() override;
     void Close() override;
     void Abort() override;
+    void Fire() override;
     Future<Connection*> GetFuture();
+    Future<void> Queue(std::unique_ptr<IOBuf> b);
+    void Flush(bool scheduled = false);
+    void AddQueueStats(QueueStats& stats);
 
    private:
-    static const constexpr double kOccupancyRatio = 0.20;
-    static const constexpr uint8_t kPreallocateChainLen = 100;
-    void check_preallocate();
-    void preallocated(std::unique_ptr<MutIOBuf> buf);
+    struct Waiting {
+      std::unique_ptr<IOBuf> buf;
+      size_t len;
+      Promise<void> promise;
+    };
+
+    // corked bytes which are sent without waiting for the flush
+    static const constexpr size_t kCorkMaxBytes = 1 << 16;
+    static const constexpr int64_t kCreditWindow = 1 << 20;
     void process_message(std::unique_ptr<MutIOBuf> b);
-    std::unique_ptr<MutIOBuf>
-    process_message_chain(std::unique_ptr<MutIOBuf> b);
+    void Cork(std::unique_ptr<IOBuf> b);
+    void Grant(uint64_t bytes);
+    void ReturnCredit();
+    std::unique_ptr<MutIOBuf> split_message();
+
+    void Push();
 
-    uint32_t preallocate_{0};
     std::unique_ptr<ebbrt::MutIOBuf> buf_;
+    size_t buf_len_{0};
+    // length of the message at the front of buf_, 0 until its header arrives
+    size_t message_len_{0};
+    // the head of buf_ is a MutSharedIOBufRef we created to split a buffer
+    bool head_shared_{false};
     ebbrt::Promise<Connection*> promise_;
+    ebbrt::SpinLock cork_lock_;
+    std::unique_ptr<IOBuf> corked_;
+    size_t corked_len_{0};
+    // a flush event or timer is outstanding
+    bool flush_pending_{false};
+    // bytes we may send before the peer returns credit, and the messages
+    // waiting for it, under cork_lock_
+    int64_t credit_{kCreditWindow};
+    std::deque<Waiting> waiting_;
+    size_t waiting_len_{0};
+    // bytes delivered since we last returned credit
+    uint64_t consumed_{0};
   };
 
+  // The connections each core has used, so that sends can find theirs
+  // without taking lock_
+  struct alignas(cache_size) CoreConnections {
+    std::unordered_map<Ipv4Address, SharedFuture<Connection*>> map;
+  };
+
+  SharedFuture<Connection*>& GetConnection(Ipv4Address ip);
+
   static uint16_t port_;
+  std::chrono::microseconds cork_window_{0};
+  size_t stripes_{0};
   NetworkManager::ListeningTcpPcb listening_pcb_;
   ebbrt::SpinLock lock_;
-  std::unordered_map<Ipv4Address, SharedFuture<Connection*>> connection_map_;
+  // All connections to each peer, both those we initiated and accepted
+  std::unordered_map<Ipv4Address, std::vector<SharedFuture<Connection*>>>
+      connection_map_;
+  std::array<CoreConnections, Cpu::kMaxCpus> core_connections_;
 };
 
 constexpr auto messenger = EbbRef<Messenger>(kMessengerId);
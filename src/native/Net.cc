@@ -4,7 +4,28 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 #include "Net.h"
 
-void ebbrt::NetworkManager::Init() {}
+#include "NetRaw.h"
+#include "PacketCapture.h"
+
+namespace {
+// Stands in for the device beneath the loopback interface. Packets sent on
+// that interface are delivered back up the stack before reaching the link
+// layer, so nothing is ever handed to it.
+class LoopbackDevice : public ebbrt::EthernetDevice {
+ public:
+  void Send(std::unique_ptr<ebbrt::IOBuf> buf,
+            ebbrt::PacketInfo pinfo) override {
+    ebbrt::kabort("Loopback device asked to transmit\n");
+  }
+  const ebbrt::EthernetAddress& GetMacAddress() override { return mac_; }
+  uint16_t GetMtu() override { return UINT16_MAX; }
+
+ private:
+  ebbrt::EthernetAddress mac_{{0, 0, 0, 0, 0, 0}};
+};
+}  // namespace
+
+void ebbrt::NetworkManager::Init() { network_manager->NewLoopback(); }
 
 ebbrt::NetworkManager::Interface&
 ebbrt::NetworkManager::NewInterface(EthernetDevice& ether_dev) {
@@ -25,7 +46,22 @@ ebbrt::NetworkManager::NewLoopback(EthernetDevice& ether_dev) {
   return *loopback_;
 }
 
+// Bring up the built in loopback interface on 127.0.0.1/8
+ebbrt::NetworkManager::Interface& ebbrt::NetworkManager::NewLoopback() {
+  loopback_dev_.reset(new LoopbackDevice());
+  loopback_.reset(new Interface(*loopback_dev_, /* loopback = */ true));
+  auto addr = std::make_unique<Interface::ItfAddress>();
+  addr->address = {{127, 0, 0, 1}};
+  addr->netmask = {{255, 0, 0, 0}};
+  addr->gateway = {{127, 0, 0, 1}};
+  loopback_->SetAddress(std::move(addr));
+  return *loopback_;
+}
+
 void ebbrt::NetworkManager::Interface::Receive(std::unique_ptr<MutIOBuf> buf) {
+  if (unlikely(PacketCapture::Enabled()))
+    packet_capture->Capture(*buf, CaptureFilter::kRx);
+
   auto packet_len = buf->ComputeChainDataLength();
 
   // Drop packets that are too small
@@ -46,6 +82,15 @@ void ebbrt::NetworkManager::Interface::Receive(std::unique_ptr<MutIOBuf> buf) {
     ReceiveArp(eth_header, std::move(buf));
     break;
   }
+  default: {
+    auto entry =
+        network_manager->raw_ethertypes_.find(ntohs(eth_header.type));
+    if (entry) {
+      buf->Retreat(sizeof(EthernetHeader));
+      EbbRef<RawPacket>(entry->id)->Deliver(std::move(buf));
+    }
+    break;
+  }
   }
 }
 
@@ -53,7 +98,18 @@ const ebbrt::EthernetAddress& ebbrt::NetworkManager::Interface::MacAddress() {
   return ether_dev_.GetMacAddress();
 }
 
+// Lower the MTU used on this interface (0 restores the device MTU). This only
+// affects connections established after the change.
+void ebbrt::NetworkManager::Interface::SetMtu(uint16_t mtu) {
+  if (mtu && (mtu < kEthMinMtu || mtu > ether_dev_.GetMtu()))
+    throw std::runtime_error("MTU not supported by device");
+
+  mtu_ = mtu;
+}
+
 void ebbrt::NetworkManager::Interface::Send(std::unique_ptr<IOBuf> b,
                                             PacketInfo pinfo) {
+  if (unlikely(PacketCapture::Enabled()))
+    packet_capture->Capture(*b, CaptureFilter::kTx);
   ether_dev_.Send(std::move(b), std::move(pinfo));
 }
@@ -9,14 +9,18 @@
 #pragma GCC diagnostic ignored "-Wunused-local-typedefs"
 #include <boost/container/list.hpp>
 #pragma GCC diagnostic pop
+#include <boost/intrusive/set.hpp>
 #include <list>
 #include <tuple>
 
 #include "../AtomicUniquePtr.h"
 #include "../IOBuf.h"
+#include "../MoveLambda.h"
 #include "../SpinLock.h"
 #include "../StaticSharedEbb.h"
 #include "Clock.h"
+#include "Cpu.h"
+#include "EphemeralPorts.h"
 #include "EventManager.h"
 #include "NetDhcp.h"
 #include "NetEth.h"
@@ -28,6 +32,8 @@
 namespace ebbrt {
 struct PacketInfo {
   static const constexpr uint8_t kNeedsCsum = 1;
+  // more packets follow immediately, the device may defer notification
+  static const constexpr uint8_t kMore = 2;
   static const constexpr uint8_t kGsoNone = 0;
   static const constexpr uint8_t kGsoTcpv4 = 1;
   static const constexpr uint8_t kGsoUdp = 3;
@@ -46,9 +52,13 @@ class EthernetDevice {
   virtual void Send(std::unique_ptr<IOBuf> buf,
                     PacketInfo pinfo = PacketInfo()) = 0;
   virtual const EthernetAddress& GetMacAddress() = 0;
+  // Largest IP packet the device can carry in a single frame
+  virtual uint16_t GetMtu() { return kEthDefaultMtu; }
   virtual ~EthernetDevice() {}
 };
 
+class RawPacket;
+
 class NetworkManager : public StaticSharedEbb<NetworkManager> {
  public:
   struct UdpEntry {
@@ -88,6 +98,11 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
     std::unique_ptr<MutIOBuf> buf;
     TcpHeader& th;
     uint16_t tcp_len;
+    // earliest departure time when paced, then the time it was last sent
+    ebbrt::clock::Wall::time_point departure;
+    bool retransmitted{false};
+    // payload held in shared buffers so it can be handed over loopback
+    bool shared{false};
   };
 
   class TcpPcb;
@@ -138,15 +153,21 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
     size_t SendWindowRemaining();
     void SetTimer(ebbrt::clock::Wall::time_point now);
     void SendSegment(TcpSegment& segment);
+    std::unique_ptr<MutIOBuf> ShareSegment(TcpSegment& segment);
     void SendEmptyAck();
     void Close();
     void SendFin();
     void Send(std::unique_ptr<IOBuf> buf);
+    void SendData(std::unique_ptr<IOBuf> buf);
     void Purge();
     void DisableTimers();
     void Destroy();
     void Disconnect(); /* Abrupt disconnect */
     bool IsConnected(); 
+    uint64_t PacingRate();
+    size_t PacingBurst();
+    void UpdateRtt(ebbrt::clock::Wall::time_point now,
+                   ebbrt::clock::Wall::time_point sent);
 
     RcuHListHook hook;
     size_t cpu;
@@ -177,6 +198,7 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
     uint32_t rcv_wnd;  // size of the receive window
     uint32_t rcv_last_acked;  // The last received byte we acked
     bool close_window{false};
+    uint16_t mss{kTcpMss};  // negotiated maximum segment size for sending
     ebbrt::clock::Wall::time_point retransmit;  // when to retransmit
     ebbrt::clock::Wall::time_point time_wait;  // when to leave time_wait state
     Promise<void> connected;
@@ -185,6 +207,18 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
     bool window_notify;
     bool timer_set{false};
     bool deleted{false};
+    // local port was reserved by the caller rather than chosen by Connect
+    bool reserved_port{false};
+    // the peer is reached through the loopback interface
+    bool loopback{false};
+    // Pacing state: segments are spaced at PacingRate() and released by the
+    // per-core TcpPacer
+    bool pacing{false};
+    uint64_t pacing_rate{0};  // bytes per second, 0 derives it from wnd/srtt
+    ebbrt::clock::Wall::time_point pacing_next;  // next free departure slot
+    ebbrt::clock::Wall::time_point pacing_release;  // when the pacer wakes us
+    boost::intrusive::set_member_hook<> pacing_hook;
+    std::chrono::microseconds srtt{0};  // smoothed round trip time
   };
 
   class TcpPcb {
@@ -194,12 +228,16 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
     uint16_t Connect(Ipv4Address address, uint16_t port,
                      uint16_t local_port = 0);
     void BindCpu(size_t index);
+    size_t GetCpu();
     void InstallHandler(std::unique_ptr<ITcpHandler> handler);
     size_t SendWindowRemaining();
     void OpenWindow();
     void CloseWindow();
     void SetWindowNotify(bool notify);
+    void SetPacing(bool enable, uint64_t bytes_per_sec = 0);
     void Send(std::unique_ptr<IOBuf> buf);
+    void SendZeroCopy(const uint8_t* ptr, size_t len,
+                      MovableFunction<void()> done);
     void Output();
     void Disconnect(); /* Force an abrupt disconnect */
     Ipv4Address GetRemoteAddress();
@@ -231,8 +269,8 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
       }
     };
 
-    explicit Interface(EthernetDevice& ether_dev)
-        : address_(nullptr), ether_dev_(ether_dev) {}
+    explicit Interface(EthernetDevice& ether_dev, bool loopback = false)
+        : address_(nullptr), ether_dev_(ether_dev), loopback_(loopback) {}
 
     void EthArpSend(uint16_t proto, const Ipv4Header& ih,
                     std::unique_ptr<MutIOBuf> buf,
@@ -244,7 +282,13 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
     void SendIp(std::unique_ptr<MutIOBuf> buf, Ipv4Address src, Ipv4Address dst,
                 uint8_t proto, PacketInfo pinfo = PacketInfo());
     const EthernetAddress& MacAddress();
+    uint16_t Mtu() const { return mtu_ ? mtu_ : ether_dev_.GetMtu(); }
+    void SetMtu(uint16_t mtu);
+    uint16_t TcpMss() const {
+      return Mtu() - sizeof(Ipv4Header) - sizeof(TcpHeader);
+    }
     const ItfAddress* Address() const { return address_.get(); }
+    bool IsLoopback() const { return loopback_; }
     void SetAddress(std::unique_ptr<ItfAddress> address) {
       address_.store(address.release());
     }
@@ -268,6 +312,7 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
 
     void ReceiveArp(EthernetHeader& eh, std::unique_ptr<MutIOBuf> buf);
     void ReceiveIp(EthernetHeader& eh, std::unique_ptr<MutIOBuf> buf);
+    void ReceiveLoopback(std::unique_ptr<MutIOBuf> buf);
     void ReceiveIcmp(EthernetHeader& eh, Ipv4Header& ih,
                      std::unique_ptr<MutIOBuf> buf);
     void ReceiveUdp(Ipv4Header& ih, std::unique_ptr<MutIOBuf> buf);
@@ -295,6 +340,8 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
 
     atomic_unique_ptr<ItfAddress, ItfAddressDeleter> address_;
     EthernetDevice& ether_dev_;
+    uint16_t mtu_{0};  // 0 uses the device MTU
+    bool loopback_;
     DhcpPcb dhcp_pcb_;
   };
 
@@ -302,6 +349,7 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
 
   Interface& NewInterface(EthernetDevice& ether_dev);
   Interface& NewLoopback(EthernetDevice& ether_dev);
+  Interface& NewLoopback();
   Ipv4Address IpAddress();
   Interface& GetInterface();
   void TcpReset(bool ack, uint32_t seqno, uint32_t ackno,
@@ -314,8 +362,27 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
               uint8_t proto, PacketInfo = PacketInfo());
   Interface* IpRoute(Ipv4Address dest);
 
+  // A tcp segment received on one core for a connection owned by another
+  struct SteeredSegment {
+    SteeredSegment* next;
+    TcpEntry* entry;
+    const Ipv4Header* ih;
+    TcpHeader* th;
+    TcpInfo info;
+    std::unique_ptr<MutIOBuf> buf;
+  };
+
+  struct alignas(cache_size) SteeringInbox {
+    std::atomic<SteeredSegment*> head{nullptr};
+  };
+
+  void SteerTcp(TcpEntry& entry, const Ipv4Header& ih, TcpHeader& th,
+                const TcpInfo& info, std::unique_ptr<MutIOBuf> buf);
+  void ReceiveSteered();
+
   std::unique_ptr<Interface> interface_;
   std::unique_ptr<Interface> loopback_;
+  std::unique_ptr<EthernetDevice> loopback_dev_;
   RcuHashTable<ArpEntry, Ipv4Address, &ArpEntry::hook, &ArpEntry::paddr>
       arp_cache_{8};  // 256 buckets
   RcuHashTable<UdpEntry, uint16_t, &UdpEntry::hook, &UdpEntry::port> udp_pcbs_{
@@ -327,19 +394,38 @@ class NetworkManager : public StaticSharedEbb<NetworkManager> {
                &TcpEntry::hook, &TcpEntry::key,
                boost::hash<std::tuple<Ipv4Address, uint16_t, uint16_t>>>
       tcp_pcbs_{8};  // 256 buckets
+  std::array<SteeringInbox, Cpu::kMaxCpus> steering_inboxes_;
+
+  // Bindings of raw packet Ebbs, keyed by EtherType or UDP port
+  struct RawEntry {
+    RcuHListHook hook;
+    uint16_t key{0};
+    EbbId id;
+  };
+
+  typedef RcuHashTable<RawEntry, uint16_t, &RawEntry::hook, &RawEntry::key>
+      RawTable;
+
+  RawTable raw_ethertypes_{4};  // 16 buckets
+  RawTable raw_udp_ports_{4};  // 16 buckets
   EbbRef<SharedPoolAllocator<uint16_t>> udp_port_allocator_{
       SharedPoolAllocator<uint16_t>::Create(49152, 65535,
                                             ebb_allocator->AllocateLocal())};
   EbbRef<SharedPoolAllocator<uint16_t>> tcp_port_allocator_{
       SharedPoolAllocator<uint16_t>::Create(49152, 65535,
                                             ebb_allocator->AllocateLocal())};
+  // per-core caches in front of the allocators above
+  EphemeralPorts udp_ports_{udp_port_allocator_};
+  EphemeralPorts tcp_ports_{tcp_port_allocator_};
 
   alignas(cache_size) ebbrt::SpinLock arp_write_lock_;
   alignas(cache_size) ebbrt::SpinLock udp_write_lock_;
   alignas(cache_size) ebbrt::SpinLock listening_tcp_write_lock_;
   alignas(cache_size) ebbrt::SpinLock tcp_write_lock_;
+  alignas(cache_size) ebbrt::SpinLock raw_write_lock_;
 
   friend void ebbrt::Main(ebbrt::multiboot::Information* mbi);
+  friend class RawPacket;
 };
 
 constexpr auto network_manager = EbbRef<NetworkManager>(kNetworkManagerId);
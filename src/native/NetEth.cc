@@ -5,6 +5,7 @@
 #include "Net.h"
 
 #include "../UniqueIOBuf.h"
+#include "NetStats.h"
 
 /// Send an Ethernet packet
 void ebbrt::NetworkManager::Interface::EthArpSend(uint16_t proto,
@@ -84,6 +85,7 @@ void ebbrt::NetworkManager::Interface::EthArpSend(uint16_t proto,
 // Receive an ARP packet
 void ebbrt::NetworkManager::Interface::ReceiveArp(
     EthernetHeader& eth_header, std::unique_ptr<MutIOBuf> buf) {
+  net_stats->Local().arp_rx++;
   auto packet_len = buf->ComputeChainDataLength();
   if (packet_len < sizeof(ArpPacket))
     return;
@@ -135,6 +137,7 @@ void ebbrt::NetworkManager::Interface::ReceiveArp(
 
       buf->Retreat(sizeof(EthernetHeader));
 
+      net_stats->Local().arp_tx++;
       Send(std::move(buf));
     }
   }
@@ -165,5 +168,6 @@ void ebbrt::NetworkManager::Interface::EthArpRequest(ArpEntry& entry) {
   arp_packet.tha = {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
   arp_packet.tpa = entry.paddr;
 
+  net_stats->Local().arp_tx++;
   Send(std::move(buf));
 }
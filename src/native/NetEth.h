@@ -12,6 +12,8 @@
 
 namespace ebbrt {
 const constexpr size_t kEthHwAddrLen = 6;
+const constexpr uint16_t kEthDefaultMtu = 1500;
+const constexpr uint16_t kEthMinMtu = 576;
 
 typedef std::array<uint8_t, kEthHwAddrLen> EthernetAddress;
 
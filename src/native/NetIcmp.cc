@@ -6,11 +6,14 @@
 
 #include "NetChecksum.h"
 #include "NetIcmp.h"
+#include "NetStats.h"
 // Receive an ICMP packet. Currently, if we get a request (ping) we just send
 // back a reply
 void ebbrt::NetworkManager::Interface::ReceiveIcmp(
     EthernetHeader& eth_header, Ipv4Header& ip_header,
     std::unique_ptr<MutIOBuf> buf) {
+  auto& stats = net_stats->Local();
+  stats.icmp_rx++;
   auto packet_len = buf->ComputeChainDataLength();
 
   if (unlikely(packet_len < sizeof(IcmpHeader)))
@@ -20,8 +23,10 @@ void ebbrt::NetworkManager::Interface::ReceiveIcmp(
   auto& icmp_header = dp.Get<IcmpHeader>();
 
   // checksum
-  if (IpCsum(*buf))
+  if (IpCsum(*buf)) {
+    stats.ip_csum_errors++;
     return;
+  }
 
   // if echo_request, send reply
   if (icmp_header.type == kIcmpEchoRequest) {
@@ -46,6 +51,7 @@ void ebbrt::NetworkManager::Interface::ReceiveIcmp(
     ip_header.chksum = ip_header.ComputeChecksum();
 
     buf->Retreat(ip_header.HeaderLength());
+    stats.icmp_tx++;
     EthArpSend(kEthTypeIp, ip_header, std::move(buf));
   }
 }
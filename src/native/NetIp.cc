@@ -4,6 +4,8 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 #include "Net.h"
 
+#include "NetStats.h"
+
 ebbrt::Ipv4Address ebbrt::NetworkManager::IpAddress() {
   if (interface_)
     return interface_->Address()->address;
@@ -38,29 +40,42 @@ bool ebbrt::NetworkManager::Interface::ItfAddress::isLocalNetwork(
 // Receive an Ipv4 packet
 void ebbrt::NetworkManager::Interface::ReceiveIp(
     EthernetHeader& eth_header, std::unique_ptr<MutIOBuf> buf) {
+  auto& stats = net_stats->Local();
+  stats.ip_rx++;
+
   auto packet_len = buf->ComputeChainDataLength();
 
-  if (unlikely(packet_len < sizeof(Ipv4Header)))
+  if (unlikely(packet_len < sizeof(Ipv4Header))) {
+    stats.ip_rx_drops++;
     return;
+  }
 
   auto dp = buf->GetMutDataPointer();
   auto& ip_header = dp.Get<Ipv4Header>();
 
-  if (unlikely(ip_header.Version() != 4))
+  if (unlikely(ip_header.Version() != 4)) {
+    stats.ip_rx_drops++;
     return;
+  }
 
   auto hlen = ip_header.HeaderLength();
-  if (unlikely(hlen < sizeof(Ipv4Header)))
+  if (unlikely(hlen < sizeof(Ipv4Header))) {
+    stats.ip_rx_drops++;
     return;
+  }
 
   auto tot_len = ip_header.TotalLength();
-  if (unlikely(packet_len < tot_len))
+  if (unlikely(packet_len < tot_len)) {
+    stats.ip_rx_drops++;
     return;
+  }
 
   buf->TrimEnd(packet_len - tot_len);
 
-  if (unlikely(ip_header.ComputeChecksum() != 0))
+  if (unlikely(ip_header.ComputeChecksum() != 0)) {
+    stats.ip_csum_errors++;
     return;
+  }
 
   auto addr = Address();
   // Unless the protocol is UDP or we have an address on this interface and the
@@ -68,16 +83,22 @@ void ebbrt::NetworkManager::Interface::ReceiveIp(
   // UDP through for DHCP to work before we have an address.
   if (unlikely(ip_header.proto != kIpProtoUDP &&
                (!addr || (!addr->isBroadcast(ip_header.dst) &&
-                          addr->address != ip_header.dst))))
+                          addr->address != ip_header.dst)))) {
+    stats.ip_rx_drops++;
     return;
+  }
 
   // Drop unacceptable sources
-  if (unlikely(ip_header.src.isBroadcast() || ip_header.src.isMulticast()))
+  if (unlikely(ip_header.src.isBroadcast() || ip_header.src.isMulticast())) {
+    stats.ip_rx_drops++;
     return;
+  }
 
   // We do not support fragmentation
-  if (unlikely(ip_header.Fragmented()))
+  if (unlikely(ip_header.Fragmented())) {
+    stats.ip_rx_drops++;
     return;
+  }
 
   buf->Advance(hlen);
 
@@ -97,6 +118,26 @@ void ebbrt::NetworkManager::Interface::ReceiveIp(
   }
 }
 
+// Receive an Ipv4 packet sent on the loopback interface. It was built by this
+// stack, so none of the checks in ReceiveIp are needed.
+void ebbrt::NetworkManager::Interface::ReceiveLoopback(
+    std::unique_ptr<MutIOBuf> buf) {
+  auto dp = buf->GetMutDataPointer();
+  auto& ip_header = dp.Get<Ipv4Header>();
+  buf->Advance(sizeof(Ipv4Header));
+
+  switch (ip_header.proto) {
+  case kIpProtoUDP: {
+    ReceiveUdp(ip_header, std::move(buf));
+    break;
+  }
+  case kIpProtoTCP: {
+    ReceiveTcp(ip_header, std::move(buf));
+    break;
+  }
+  }
+}
+
 void ebbrt::NetworkManager::SendIp(std::unique_ptr<MutIOBuf> buf,
                                    Ipv4Address src, Ipv4Address dst,
                                    uint8_t proto, PacketInfo pinfo) {
@@ -123,6 +164,19 @@ void ebbrt::NetworkManager::Interface::SendIp(std::unique_ptr<MutIOBuf> buf,
   ih.chksum = 0;
   ih.src = src;
   ih.dst = dst;
+
+  if (loopback_) {
+    // The packet never leaves this machine, so skip the checksums and the
+    // link layer entirely. Delivery is deferred so that the sender does not
+    // reenter the stack from within its own send path.
+    event_manager->SpawnLocal(
+        [this, buf = std::move(buf)]() mutable {
+          ReceiveLoopback(std::move(buf));
+        },
+        /* force_async = */ true);
+    return;
+  }
+
   ih.chksum = ih.ComputeChecksum();
 
   kassert(ih.ComputeChecksum() == 0);
@@ -130,6 +184,7 @@ void ebbrt::NetworkManager::Interface::SendIp(std::unique_ptr<MutIOBuf> buf,
   pinfo.csum_start += sizeof(Ipv4Header);
   pinfo.hdr_len += sizeof(Ipv4Header);
 
+  net_stats->Local().ip_tx++;
   EthArpSend(kEthTypeIp, ih, std::move(buf), pinfo);
 }
 
@@ -137,7 +192,7 @@ void ebbrt::NetworkManager::Interface::SendIp(std::unique_ptr<MutIOBuf> buf,
 ebbrt::NetworkManager::Interface*
 ebbrt::NetworkManager::IpRoute(Ipv4Address dest) {
 
-  if (dest.isLinkLocal()) {
+  if (dest.isLoopback()) {
     if (!loopback_)
       return nullptr;
 
@@ -86,6 +86,8 @@ class __attribute__((packed)) Ipv4Address {
 
   bool isLinkLocal() const { return addr_[0] == 169 && addr_[1] == 254; }
 
+  bool isLoopback() const { return addr_[0] == 127; }
+
   uint32_t toU32() const {
     return *reinterpret_cast<const uint32_t*>(addr_.data());
   }
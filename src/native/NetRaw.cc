@@ -0,0 +1,156 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "NetRaw.h"
+
+#include "Rcu.h"
+
+void ebbrt::RawPacket::Bind(NetworkManager::RawTable& table, EbbId id,
+                            uint16_t key) {
+  std::lock_guard<ebbrt::SpinLock> guard(network_manager->raw_write_lock_);
+  if (table.find(key))
+    throw std::runtime_error("Raw packet binding already in use");
+
+  auto entry = new NetworkManager::RawEntry();
+  entry->key = key;
+  entry->id = id;
+  table.insert(*entry);
+}
+
+ebbrt::Future<void>
+ebbrt::RawPacket::Unbind(NetworkManager::RawTable& table, uint16_t key) {
+  NetworkManager::RawEntry* entry;
+  {
+    std::lock_guard<ebbrt::SpinLock> guard(network_manager->raw_write_lock_);
+    entry = table.find(key);
+    if (!entry)
+      throw std::runtime_error("Raw packet binding not found");
+    table.erase(*entry);
+  }
+  // a receiver may still hold the entry until the grace period ends
+  return CallRcu([entry]() { delete entry; });
+}
+
+void ebbrt::RawPacket::BindEtherType(EbbRef<RawPacket> ref,
+                                     uint16_t ethertype) {
+  if (ethertype == kEthTypeIp || ethertype == kEthTypeArp)
+    throw std::runtime_error("EtherType is owned by the network stack");
+
+  Bind(network_manager->raw_ethertypes_, static_cast<EbbId>(ref), ethertype);
+}
+
+void ebbrt::RawPacket::BindUdpPort(EbbRef<RawPacket> ref, uint16_t port) {
+  if (!port)
+    throw std::runtime_error("Raw packet binding requires a port");
+
+  Bind(network_manager->raw_udp_ports_, static_cast<EbbId>(ref), port);
+}
+
+ebbrt::Future<void> ebbrt::RawPacket::UnbindEtherType(uint16_t ethertype) {
+  return Unbind(network_manager->raw_ethertypes_, ethertype);
+}
+
+ebbrt::Future<void> ebbrt::RawPacket::UnbindUdpPort(uint16_t port) {
+  return Unbind(network_manager->raw_udp_ports_, port);
+}
+
+std::unique_ptr<ebbrt::MutUniqueIOBuf> ebbrt::RawPacket::Alloc(size_t len) {
+  auto buf = MakeUniqueIOBuf(kHeadroom + len);
+  buf->Advance(kHeadroom);
+  return buf;
+}
+
+void ebbrt::RawPacket::Receive(
+    MovableFunction<void(std::unique_ptr<MutIOBuf>)> func) {
+  func_ = std::move(func);
+}
+
+// Called by the network stack on the core the frame arrived on
+void ebbrt::RawPacket::Deliver(std::unique_ptr<MutIOBuf> frame) {
+  if (unlikely(!func_))
+    return;
+
+  func_(std::move(frame));
+}
+
+void ebbrt::RawPacket::SendFrame(const EthernetAddress& dst,
+                                 uint16_t ethertype,
+                                 std::unique_ptr<MutIOBuf> buf) {
+  buf->Retreat(sizeof(EthernetHeader));
+  auto dp = buf->GetMutDataPointer();
+  auto& eh = dp.Get<EthernetHeader>();
+  eh.dst = dst;
+  eh.src = network_manager->GetInterface().MacAddress();
+  eh.type = htons(ethertype);
+  Queue(std::move(buf));
+}
+
+void ebbrt::RawPacket::SendUdp(const EthernetAddress& dst_mac,
+                               Ipv4Address dst, uint16_t dst_port,
+                               uint16_t src_port,
+                               std::unique_ptr<MutIOBuf> buf) {
+  auto& itf = network_manager->GetInterface();
+  auto itf_addr = itf.Address();
+  auto src = itf_addr ? itf_addr->address : Ipv4Address::Any();
+  auto len = buf->ComputeChainDataLength();
+
+  buf->Retreat(sizeof(UdpHeader));
+  auto udp_dp = buf->GetMutDataPointer();
+  auto& uh = udp_dp.Get<UdpHeader>();
+  uh.src_port = htons(src_port);
+  uh.dst_port = htons(dst_port);
+  uh.length = htons(len + sizeof(UdpHeader));
+  uh.checksum = 0;
+
+  buf->Retreat(sizeof(Ipv4Header));
+  auto ip_dp = buf->GetMutDataPointer();
+  auto& ih = ip_dp.Get<Ipv4Header>();
+  ih.version_ihl = 4 << 4 | 5;
+  ih.dscp_ecn = 0;
+  ih.length = htons(len + sizeof(UdpHeader) + sizeof(Ipv4Header));
+  ih.id = 0;
+  ih.flags_fragoff = 0;
+  ih.ttl = kIpDefaultTtl;
+  ih.proto = kIpProtoUDP;
+  ih.chksum = 0;
+  ih.src = src;
+  ih.dst = dst;
+  ih.chksum = ih.ComputeChecksum();
+
+  SendFrame(dst_mac, kEthTypeIp, std::move(buf));
+}
+
+void ebbrt::RawPacket::Queue(std::unique_ptr<MutIOBuf> buf) {
+  pending_.emplace_back(std::move(buf));
+  if (pending_.size() >= kMaxBatch) {
+    Flush();
+    return;
+  }
+  // Anything queued by the current event goes out as one batch once it
+  // finishes
+  if (!flush_scheduled_) {
+    flush_scheduled_ = true;
+    event_manager->SpawnLocal(
+        [this]() {
+          flush_scheduled_ = false;
+          Flush();
+        },
+        /* force_async = */ true);
+  }
+}
+
+void ebbrt::RawPacket::Flush() {
+  if (pending_.empty())
+    return;
+
+  auto& itf = network_manager->GetInterface();
+  auto last = pending_.size() - 1;
+  for (size_t i = 0; i <= last; ++i) {
+    PacketInfo pinfo;
+    if (i != last)
+      pinfo.flags |= PacketInfo::kMore;
+    itf.Send(std::move(pending_[i]), std::move(pinfo));
+  }
+  pending_.clear();
+}
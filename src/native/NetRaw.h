@@ -0,0 +1,72 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef BAREMETAL_SRC_INCLUDE_EBBRT_NETRAW_H_
+#define BAREMETAL_SRC_INCLUDE_EBBRT_NETRAW_H_
+
+#include <vector>
+
+#include "../MoveLambda.h"
+#include "../MulticoreEbb.h"
+#include "../UniqueIOBuf.h"
+#include "Net.h"
+#include "NetUdp.h"
+
+namespace ebbrt {
+// Direct access to the wire for datagram transports that do not want TCP or
+// the UdpPcb path. An instance is bound to EtherTypes and/or UDP ports and
+// receives every matching frame whole, starting at the Ethernet header, on
+// the core it arrived on. Each core installs its own receive callback.
+//
+// Transmission writes the headers in place into the headroom left by Alloc
+// and queues the frame on the calling core. Queued frames are handed to the
+// device together, so that it is notified once per batch, either when
+// kMaxBatch frames are queued, on Flush, or once the current event finishes.
+class RawPacket : public MulticoreEbb<RawPacket> {
+ public:
+  static const constexpr size_t kMaxBatch = 32;
+  static const constexpr size_t kHeadroom =
+      sizeof(EthernetHeader) + sizeof(Ipv4Header) + sizeof(UdpHeader);
+
+  // Route frames of an EtherType, or UDP datagrams to a port, to an instance.
+  // A bound UDP port takes precedence over any UdpPcb on the same port.
+  static void BindEtherType(EbbRef<RawPacket> ref, uint16_t ethertype);
+  static void BindUdpPort(EbbRef<RawPacket> ref, uint16_t port);
+  // The returned future is fulfilled once no further frames can be delivered
+  // for the binding
+  static Future<void> UnbindEtherType(uint16_t ethertype);
+  static Future<void> UnbindUdpPort(uint16_t port);
+
+  // Allocate a buffer with len bytes of payload and room for the headers
+  static std::unique_ptr<MutUniqueIOBuf> Alloc(size_t len);
+
+  // Set the receive callback of the calling core
+  void Receive(MovableFunction<void(std::unique_ptr<MutIOBuf>)> func);
+  void Deliver(std::unique_ptr<MutIOBuf> frame);
+
+  // Queue a frame whose payload begins at buf's data pointer, which must have
+  // been allocated by Alloc
+  void SendFrame(const EthernetAddress& dst, uint16_t ethertype,
+                 std::unique_ptr<MutIOBuf> buf);
+  // As above, also writing IP and UDP headers. The UDP checksum is left
+  // empty.
+  void SendUdp(const EthernetAddress& dst_mac, Ipv4Address dst,
+               uint16_t dst_port, uint16_t src_port,
+               std::unique_ptr<MutIOBuf> buf);
+  // Hand all frames queued on this core to the device
+  void Flush();
+
+ private:
+  static void Bind(NetworkManager::RawTable& table, EbbId id, uint16_t key);
+  static Future<void> Unbind(NetworkManager::RawTable& table, uint16_t key);
+
+  void Queue(std::unique_ptr<MutIOBuf> buf);
+
+  MovableFunction<void(std::unique_ptr<MutIOBuf>)> func_;
+  std::vector<std::unique_ptr<IOBuf>> pending_;
+  bool flush_scheduled_{false};
+};
+}  // namespace ebbrt
+
+#endif  // BAREMETAL_SRC_INCLUDE_EBBRT_NETRAW_H_
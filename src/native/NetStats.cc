@@ -0,0 +1,35 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "NetStats.h"
+
+#include "../UniqueIOBuf.h"
+#include "Messenger.h"
+
+EBBRT_PUBLISH_TYPE(ebbrt, NetStats);
+
+// Sum the counters of every core. Other cores keep counting while we read, so
+// the result is not a consistent snapshot, but each counter is exact to within
+// the updates in flight.
+ebbrt::NetCounters ebbrt::NetStats::Aggregate() const {
+  NetCounters total;
+  for (size_t i = 0; i < Cpu::Count(); ++i)
+    total += counters_[i].counters;
+  return total;
+}
+
+// A frontend asking for our counters
+void ebbrt::NetStats::ReceiveMessage(Messenger::NetworkId nid,
+                                     std::unique_ptr<IOBuf>&& buf) {
+  if (buf->ComputeChainDataLength() < sizeof(NetStatsRequest))
+    return;
+
+  auto dp = buf->GetDataPointer();
+  const auto& request = dp.Get<NetStatsRequest>();
+  auto reply_buf = MakeUniqueIOBuf(sizeof(NetStatsReply));
+  auto& reply = *reinterpret_cast<NetStatsReply*>(reply_buf->MutData());
+  reply.id = request.id;
+  reply.counters = Aggregate();
+  SendMessage(nid, std::move(reply_buf));
+}
@@ -0,0 +1,47 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef BAREMETAL_SRC_INCLUDE_EBBRT_NETSTATS_H_
+#define BAREMETAL_SRC_INCLUDE_EBBRT_NETSTATS_H_
+
+#include <array>
+
+#include "../CacheAligned.h"
+#include "../Message.h"
+#include "../NetCounters.h"
+#include "../StaticSharedEbb.h"
+#include "Cpu.h"
+#include "EbbRef.h"
+#include "StaticIds.h"
+
+namespace ebbrt {
+// Network stack counters. Each core updates its own cache line without
+// synchronization; the counters of all cores are only summed when someone
+// asks for them, either locally or from a hosted frontend via the Messenger.
+class NetStats : public StaticSharedEbb<NetStats>,
+                 public CacheAligned,
+                 public Messagable<NetStats> {
+ public:
+  static void ClassInit() {}  // no class wide static initialization logic
+
+  NetStats() : Messagable<NetStats>(kNetStatsId) {}
+
+  // Counters of the calling core
+  NetCounters& Local() { return counters_[Cpu::GetMine()].counters; }
+  NetCounters Aggregate() const;
+
+  void ReceiveMessage(Messenger::NetworkId nid, std::unique_ptr<IOBuf>&& buf);
+
+ private:
+  struct alignas(cache_size) CoreCounters {
+    NetCounters counters;
+  };
+
+  std::array<CoreCounters, Cpu::kMaxCpus> counters_;
+};
+
+constexpr auto net_stats = EbbRef<NetStats>(kNetStatsId);
+}  // namespace ebbrt
+
+#endif  // BAREMETAL_SRC_INCLUDE_EBBRT_NETSTATS_H_
@@ -5,16 +5,52 @@
 #include "Net.h"
 
 #include "../IOBufRef.h"
+#include "../SharedIOBufRef.h"
 #include "../Timer.h"
 #include "../UniqueIOBuf.h"
+#include "../ZeroCopyIOBuf.h"
 #include "NetChecksum.h"
+#include "NetStats.h"
+#include "NetTcpPacer.h"
 #include "Random.h"
 
+namespace {
+// Returns the MSS advertised in the options of a SYN segment, or the RFC 1122
+// default if the option is absent
+uint16_t TcpOptionMss(const ebbrt::TcpHeader& th) {
+  auto opts = reinterpret_cast<const uint8_t*>(th.options);
+  auto len = th.HdrLen() - sizeof(ebbrt::TcpHeader);
+  size_t i = 0;
+  while (i < len) {
+    auto kind = opts[i];
+    if (kind == ebbrt::kTcpOptEnd)
+      break;
+    if (kind == ebbrt::kTcpOptNop) {
+      ++i;
+      continue;
+    }
+    if (i + 1 >= len)
+      break;
+    auto opt_len = opts[i + 1];
+    if (opt_len < 2 || i + opt_len > len)
+      break;
+    if (kind == ebbrt::kTcpOptMss && opt_len == 4) {
+      auto mss = (static_cast<uint16_t>(opts[i + 2]) << 8) | opts[i + 3];
+      if (mss > 0)
+        return mss;
+    }
+    i += opt_len;
+  }
+  return ebbrt::kTcpDefaultMss;
+}
+}  // namespace
+
 // Destroy a listening tcp pcb
 void ebbrt::NetworkManager::ListeningTcpPcb::ListeningTcpEntryDeleter::
 operator()(ListeningTcpEntry* e) {
   if (e->port) {
-    network_manager->tcp_port_allocator_->Free(e->port);
+    if (e->port >= 49152)
+      network_manager->tcp_ports_.Free(e->port);
     std::lock_guard<ebbrt::SpinLock> guard(
         network_manager->listening_tcp_write_lock_);
     network_manager->listening_tcp_pcbs_.erase(*e);
@@ -46,7 +82,7 @@ void ebbrt::NetworkManager::TcpPcb::TcpEntryDeleter::operator()(TcpEntry* e) {
 uint16_t ebbrt::NetworkManager::ListeningTcpPcb::Bind(
     uint16_t port, MovableFunction<void(TcpPcb)> accept) {
   if (!port) {
-    auto ret = network_manager->tcp_port_allocator_->Allocate();
+    auto ret = network_manager->tcp_ports_.Allocate();
     if (!ret)
       throw std::runtime_error("Failed to allocate ephemeral port");
 
@@ -77,20 +113,31 @@ uint16_t ebbrt::NetworkManager::TcpPcb::Connect(Ipv4Address address,
   }
 
   if (!local_port) {
-    auto ret = network_manager->tcp_port_allocator_->Allocate();
+    // Any port not already connected to this destination will do
+    auto ret = network_manager->tcp_ports_.Select(
+        address, port, [address, port](uint16_t lport) {
+          return network_manager->tcp_pcbs_.find(
+                     std::make_tuple(address, port, lport)) ||
+                 network_manager->listening_tcp_pcbs_.find(lport);
+        });
     if (!ret)
       throw std::runtime_error("Failed to allocate ephemeral port");
 
     local_port = *ret;
-  } else if (local_port >= 49152 &&
-             !network_manager->tcp_port_allocator_->Reserve(local_port)) {
-    throw std::runtime_error("Failed to reserve specified port");
+  } else if (local_port >= 49152) {
+    if (!network_manager->tcp_port_allocator_->Reserve(local_port))
+      throw std::runtime_error("Failed to reserve specified port");
+
+    entry_->reserved_port = true;
   }
 
   // Setup state
   entry_->cpu = Cpu::GetMine();
   entry_->accepted = true;
   entry_->address = itf->Address()->address;
+  entry_->loopback = itf->IsLoopback();
+  // Lowered to the peer's MSS once we receive its SYN
+  entry_->mss = itf->TcpMss();
   std::get<0>(entry_->key) = address;
   std::get<1>(entry_->key) = port;
   std::get<2>(entry_->key) = local_port;
@@ -132,7 +179,7 @@ uint16_t ebbrt::NetworkManager::TcpPcb::Connect(Ipv4Address address,
   auto dp = new_buf->GetMutDataPointer();
   auto& tcp_header = dp.Get<TcpHeader>();
   auto opts = reinterpret_cast<uint32_t*>((&tcp_header) + 1);
-  *opts = htonl(0x02040000 | (1460 & 0xFFFF));
+  *opts = htonl(0x02040000 | (itf->TcpMss() & 0xFFFF));
   auto nop_ptr = reinterpret_cast<uint8_t*>(opts+1);
   nop_ptr[0] = 0x1; // NOP
   nop_ptr[1] = 0x3; // WS type
@@ -161,6 +208,9 @@ void ebbrt::NetworkManager::TcpPcb::BindCpu(size_t index) {
   entry_->cpu = index;
 }
 
+// The core on which the connection's handler callbacks are invoked
+size_t ebbrt::NetworkManager::TcpPcb::GetCpu() { return entry_->cpu; }
+
 // Install a handler for TCP connection events (receive packet, window size
 // change, etc.)
 void ebbrt::NetworkManager::TcpPcb::InstallHandler(
@@ -178,6 +228,23 @@ void ebbrt::NetworkManager::TcpPcb::SetWindowNotify(bool notify) {
   entry_->window_notify = notify;
 }
 
+// Enable/Disable pacing of this connection. When enabled, segments are spaced
+// out at bytes_per_sec or, if that is zero, at a rate derived from the send
+// window and the measured round trip time. Must be called on the core the
+// connection is bound to.
+void ebbrt::NetworkManager::TcpPcb::SetPacing(bool enable,
+                                              uint64_t bytes_per_sec) {
+  entry_->pacing = enable;
+  entry_->pacing_rate = bytes_per_sec;
+  if (!enable) {
+    tcp_pacer->Cancel(*entry_);
+    entry_->pacing_next = ebbrt::clock::Wall::time_point();
+    for (auto& segment : entry_->pending_segments) {
+      segment.departure = ebbrt::clock::Wall::time_point();
+    }
+  }
+}
+
 // Send TCP data on a connection. The user must ensure that the remote
 // window is large enough as the PCB will do no buffering
 void ebbrt::NetworkManager::TcpPcb::Send(std::unique_ptr<IOBuf> buf) {
@@ -192,10 +259,23 @@ void ebbrt::NetworkManager::TcpPcb::Send(std::unique_ptr<IOBuf> buf) {
   entry_->Send(std::move(buf));
 }
 
+// Send application memory without copying it. The memory must remain valid
+// and unmodified until done is invoked, which happens (on the connection's
+// core) once every byte has been acknowledged by the peer or the connection
+// has been torn down: done runs when the last segment holding the memory is
+// freed, and only our own segments ever hold it. Devices are lent references
+// for the duration of a transmission, and a loopback receiver is given a
+// copy (see TcpEntry::ShareSegment).
+void ebbrt::NetworkManager::TcpPcb::SendZeroCopy(
+    const uint8_t* ptr, size_t len, MovableFunction<void()> done) {
+  Send(MakeZeroCopyIOBuf(ptr, len, std::move(done)));
+}
+
 void ebbrt::NetworkManager::TcpPcb::Disconnect() {
   entry_->Disconnect(); //Disconnect
-  auto lport = std::get<2>(entry_->key);
-  network_manager->tcp_port_allocator_->Free(lport);
+  // ports chosen by Connect are shared and stay with their core
+  if (entry_->reserved_port)
+    network_manager->tcp_port_allocator_->Free(std::get<2>(entry_->key));
 }
 
 void ebbrt::NetworkManager::TcpPcb::Output() {
@@ -211,6 +291,8 @@ ebbrt::Ipv4Address ebbrt::NetworkManager::TcpPcb::GetRemoteAddress() {
 // Receive a TCP packet on an interface
 void ebbrt::NetworkManager::Interface::ReceiveTcp(
     const Ipv4Header& ih, std::unique_ptr<MutIOBuf> buf) {
+  auto& stats = net_stats->Local();
+  stats.tcp_rx++;
   auto packet_len = buf->ComputeChainDataLength();
 
   // Ensure we have a header
@@ -233,6 +315,9 @@ void ebbrt::NetworkManager::Interface::ReceiveTcp(
   if (unlikely(hdr_len < sizeof(TcpHeader) || hdr_len > packet_len))
     return;
 
+  if (unlikely(tcp_header.Flags() & kTcpRst))
+    stats.tcp_rst_rx++;
+
   // salient info for a tcp packet which we reuse throughout the process
   TcpInfo info = {.src_port = ntohs(tcp_header.src_port),
                   .dst_port = ntohs(tcp_header.dst_port),
@@ -251,14 +336,7 @@ void ebbrt::NetworkManager::Interface::ReceiveTcp(
     if (entry->cpu == Cpu::GetMine()) {
       entry->Input(ih, tcp_header, info, std::move(buf));
     } else {
-      // XXX: Really nervous about passing these references, but I think its all
-      // safe, for now
-      auto f = [
-        &ih, &tcp_header, entry, buf = std::move(buf), info = std::move(info)
-      ]() mutable {
-        entry->Input(ih, tcp_header, info, std::move(buf));
-      };
-      event_manager->SpawnRemote(std::move(f), entry->cpu);
+      network_manager->SteerTcp(*entry, ih, tcp_header, info, std::move(buf));
     }
   } else {
     // If no connection found, check listening pcbs
@@ -310,7 +388,13 @@ void ebbrt::NetworkManager::TcpEntry::Fire() {
   // timer and move all unacked segments to pending
   if (retransmit != ebbrt::clock::Wall::time_point() && now >= retransmit) {
     retransmit = ebbrt::clock::Wall::time_point();
-    // Move all unacked segments to the front of the pending segments queue
+    // Move all unacked segments to the front of the pending segments queue.
+    // They must not be used for RTT estimation (Karn's algorithm) and are
+    // given fresh departure times if paced
+    for (auto& segment : unacked_segments) {
+      segment.retransmitted = true;
+      segment.departure = ebbrt::clock::Wall::time_point();
+    }
     pending_segments.splice(pending_segments.begin(),
                             std::move(unacked_segments));
   }
@@ -356,6 +440,8 @@ void ebbrt::NetworkManager::TcpEntry::DisableTimers() {
 void ebbrt::NetworkManager::TcpEntry::Purge() {
   unacked_segments.clear();
   pending_segments.clear();
+  // Nothing left to send, so stop waiting on the pacer
+  tcp_pacer->Cancel(*this);
 }
 
 void ebbrt::NetworkManager::TcpEntry::Disconnect() {
@@ -380,6 +466,53 @@ void ebbrt::NetworkManager::TcpEntry::Destroy() {
   event_manager->DoRcu([this]() { delete this; });
 }
 
+// The device picks the receive queue, and so the core, of each packet
+// without regard for which core owns its connection. Segments that land on
+// the wrong core are handed to the owner through a per-core inbox. Only the
+// segment which finds the inbox empty spawns an event to drain it, so under
+// load the owner picks up segments in batches rather than taking an event
+// per segment.
+// XXX: ih and th point into buf, which travels with them, and entry is
+// protected by RCU as it was when we ran segments remotely one at a time
+void ebbrt::NetworkManager::SteerTcp(TcpEntry& entry, const Ipv4Header& ih,
+                                     TcpHeader& th, const TcpInfo& info,
+                                     std::unique_ptr<MutIOBuf> buf) {
+  net_stats->Local().tcp_steered++;
+  auto segment = new SteeredSegment{nullptr, &entry, &ih, &th, info,
+                                    std::move(buf)};
+  auto cpu = entry.cpu;
+  auto& inbox = steering_inboxes_[cpu];
+  auto head = inbox.head.load(std::memory_order_relaxed);
+  do {
+    segment->next = head;
+  } while (!inbox.head.compare_exchange_weak(head, segment,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+  if (!head) {
+    event_manager->SpawnRemote([]() { network_manager->ReceiveSteered(); },
+                               cpu);
+  }
+}
+
+// Input the segments steered to this core, in the order they were received
+void ebbrt::NetworkManager::ReceiveSteered() {
+  auto& inbox = steering_inboxes_[Cpu::GetMine()];
+  auto list = inbox.head.exchange(nullptr, std::memory_order_acquire);
+  SteeredSegment* ordered = nullptr;
+  while (list) {
+    auto next = list->next;
+    list->next = ordered;
+    ordered = list;
+    list = next;
+  }
+  while (ordered) {
+    std::unique_ptr<SteeredSegment> segment(ordered);
+    ordered = segment->next;
+    segment->entry->Input(*segment->ih, *segment->th, segment->info,
+                          std::move(segment->buf));
+  }
+}
+
 // Input tcp segment to a listening PCB
 void ebbrt::NetworkManager::ListeningTcpEntry::Input(
     const Ipv4Header& ih, TcpHeader& th, TcpInfo& info,
@@ -408,6 +541,11 @@ void ebbrt::NetworkManager::ListeningTcpEntry::Input(
     // Setup entry initial state
     entry->cpu = Cpu::GetMine();
     entry->address = ih.dst;
+    // Send no larger than what either side can carry
+    auto itf = network_manager->IpRoute(ih.src);
+    uint16_t local_mss = itf ? itf->TcpMss() : kTcpMss;
+    entry->mss = std::min(TcpOptionMss(th), local_mss);
+    entry->loopback = itf && itf->IsLoopback();
     std::get<0>(entry->key) = ih.src;
     std::get<1>(entry->key) = info.src_port;
     std::get<2>(entry->key) = info.dst_port;
@@ -452,7 +590,7 @@ void ebbrt::NetworkManager::ListeningTcpEntry::Input(
     auto dp = new_buf->GetMutDataPointer();
     auto& tcp_header = dp.Get<TcpHeader>();
     auto opts = reinterpret_cast<uint32_t*>((&tcp_header) + 1);
-    *opts = htonl(0x02040000 | (1460 & 0xFFFF));
+    *opts = htonl(0x02040000 | (local_mss & 0xFFFF));
     auto nop_ptr = reinterpret_cast<uint8_t*>(opts+1);
     nop_ptr[0] = 0x1; // NOP
     nop_ptr[1] = 0x3; // WS type
@@ -515,6 +653,52 @@ bool TcpSeqGEQ(uint32_t first, uint32_t second) {
 
 // Send on a TCP connection
 void ebbrt::NetworkManager::TcpEntry::Send(std::unique_ptr<IOBuf> buf) {
+  if (pacing) {
+    // A single TSO segment leaves the NIC as a line rate burst, so when
+    // pacing we break the data into segments of at most PacingBurst() bytes
+    // which are then individually given departure times
+    auto burst = PacingBurst();
+    while (buf->ComputeChainDataLength() > burst) {
+      std::unique_ptr<IOBuf> head;
+      size_t remaining = burst;
+      while (remaining > 0) {
+        auto rest = buf->Pop();
+        auto len = buf->Length();
+        if (len > remaining) {
+          // this buffer straddles the boundary, split it with two views
+          auto left = IOBuf::Create<SharedIOBufRef>(SharedIOBufRef::CloneView,
+                                                    std::move(buf));
+          auto right =
+              IOBuf::Create<SharedIOBufRef>(SharedIOBufRef::CloneView, *left);
+          left->TrimEnd(len - remaining);
+          right->Advance(remaining);
+          buf = std::move(right);
+          if (rest)
+            buf->PrependChain(std::move(rest));
+          len = remaining;
+          if (head) {
+            head->PrependChain(std::move(left));
+          } else {
+            head = std::move(left);
+          }
+        } else {
+          if (head) {
+            head->PrependChain(std::move(buf));
+          } else {
+            head = std::move(buf);
+          }
+          buf = std::move(rest);
+        }
+        remaining -= len;
+      }
+      SendData(std::move(head));
+    }
+  }
+  SendData(std::move(buf));
+}
+
+// Enqueue a single segment of data
+void ebbrt::NetworkManager::TcpEntry::SendData(std::unique_ptr<IOBuf> buf) {
   // Prepend a header to the chain which will Ack any received data
   auto header_buf = MakeUniqueIOBuf(sizeof(TcpHeader) + sizeof(Ipv4Header) +
                                     sizeof(EthernetHeader));
@@ -525,6 +709,54 @@ void ebbrt::NetworkManager::TcpEntry::Send(std::unique_ptr<IOBuf> buf) {
   EnqueueSegment(tcp_header, std::move(header_buf), kTcpAck);
 }
 
+// The rate (in bytes per second) at which segments are paced, 0 if unknown
+uint64_t ebbrt::NetworkManager::TcpEntry::PacingRate() {
+  if (pacing_rate)
+    return pacing_rate;
+
+  if (srtt.count() == 0)
+    return 0;
+
+  // We do no congestion control, so the send window is what may be in flight
+  // per round trip. Pace slightly faster than that (a gain of 1.2) so that
+  // pacing smooths the bursts out without itself limiting throughput
+  uint64_t wnd = snd_wnd;
+  return wnd * 1000000 * 6 / 5 / srtt.count();
+}
+
+// The largest segment to hand to the device when pacing: about a millisecond
+// of data at the pacing rate, but at least two full sized segments
+size_t ebbrt::NetworkManager::TcpEntry::PacingBurst() {
+  const constexpr size_t max_ipv4_header_size = 60;
+  const constexpr size_t max_tcp_header_size = 60;
+  const constexpr size_t max_ipv4_packet_size = UINT16_MAX;
+  const constexpr size_t max_tcp_segment_size =
+      max_ipv4_packet_size - max_tcp_header_size - max_ipv4_header_size;
+
+  auto rate = PacingRate();
+  if (rate == 0)
+    return max_tcp_segment_size;
+
+  size_t burst = rate / 1000;
+  burst = std::max(burst, 2 * static_cast<size_t>(mss));
+  return std::min(burst, max_tcp_segment_size);
+}
+
+// Fold a round trip sample into the smoothed RTT (RFC 6298)
+void ebbrt::NetworkManager::TcpEntry::UpdateRtt(
+    ebbrt::clock::Wall::time_point now, ebbrt::clock::Wall::time_point sent) {
+  auto sample =
+      std::chrono::duration_cast<std::chrono::microseconds>(now - sent);
+  if (sample.count() <= 0)
+    sample = std::chrono::microseconds(1);
+
+  if (srtt.count() == 0) {
+    srtt = sample;
+  } else {
+    srtt = (srtt * 7 + sample) / 8;
+  }
+}
+
 size_t ebbrt::NetworkManager::TcpEntry::SendWindowRemaining() {
 #ifdef LARGE_WINDOW_HACK
   return (1 << 21) - static_cast<size_t>((snd_nxt - snd_una));
@@ -602,6 +834,7 @@ bool ebbrt::NetworkManager::TcpEntry::Receive(
         snd_una = info.ackno;
         state = kEstablished;
         snd_wnd = ntohs(th.wnd) << kWindowShift;
+        mss = std::min(mss, TcpOptionMss(th));
         snd_wl1 = info.seqno;
         snd_wl2 = info.ackno;
 
@@ -807,6 +1040,7 @@ bool ebbrt::NetworkManager::TcpEntry::Receive(
             // "Segments with higher begining sequence numbers may be held for
             // later processing."
             buf->Advance(hdr_len);
+            net_stats->Local().tcp_out_of_order++;
             if (stashed_segments.count(info.seqno) == 0) {
               stashed_segments.emplace(info.seqno, std::move(buf));
             }
@@ -915,13 +1149,19 @@ bool ebbrt::NetworkManager::TcpEntry::Receive(
 }
 
 void ebbrt::NetworkManager::TcpEntry::ClearAckedSegments(const TcpInfo& info) {
+  // Send time of the most recent acked segment that was never retransmitted
+  ebbrt::clock::Wall::time_point rtt_sent;
+
   // Function to clear acked segments from a queue
   auto clear_acked_segments =
-      [&info](boost::container::list<TcpSegment>& queue) {
+      [&info, &rtt_sent](boost::container::list<TcpSegment>& queue) {
         auto it = queue.begin();
         while (it != queue.end()) {
           if (TcpSeqGT(ntohl(it->th.seqno) + it->SeqLen(), info.ackno))
             break;
+          if (!it->retransmitted &&
+              it->departure != ebbrt::clock::Wall::time_point())
+            rtt_sent = it->departure;
           auto prev_it = it++;
           queue.erase(prev_it);
         }
@@ -930,6 +1170,9 @@ void ebbrt::NetworkManager::TcpEntry::ClearAckedSegments(const TcpInfo& info) {
   // Remove all unacked segments that have been completely acked by
   // this ACK
   clear_acked_segments(unacked_segments);
+  if (rtt_sent != ebbrt::clock::Wall::time_point()) {
+    UpdateRtt(ebbrt::clock::Wall::Now(), rtt_sent);
+  }
   // Its also possible to find pending segments which have been ACKed
   // because we may have hit a retransmit timer which would cause them
   // to be moved back to the pending_segments queue. Remove them
@@ -968,11 +1211,29 @@ ebbrt::NetworkManager::TcpEntry::Output(ebbrt::clock::Wall::time_point now) {
 
   // try to send as many pending segments as will fit in the window
   size_t sent = 0;
+  bool paced = false;
+  auto rate = pacing ? PacingRate() : 0;
   for (; it != pending_segments.end() &&
          TcpSeqLEQ(ntohl(it->th.seqno) + it->tcp_len,
                    snd_nxt + SendWindowRemaining());
        ++it) {
+    if (rate) {
+      if (it->departure == ebbrt::clock::Wall::time_point()) {
+        // Stamp the segment with its earliest departure time and reserve the
+        // time it occupies on the wire at the pacing rate
+        it->departure = std::max(now, pacing_next);
+        uint64_t wire_ns = static_cast<uint64_t>(it->tcp_len) * 1000000000;
+        pacing_next = it->departure + std::chrono::nanoseconds(wire_ns / rate);
+      }
+      if (it->departure > now) {
+        // Not due yet, have the per-core pacer release us when it is
+        tcp_pacer->Schedule(*this, it->departure);
+        paced = true;
+        break;
+      }
+    }
     SendSegment(*it);
+    it->departure = now;
     ++sent;
   }
 
@@ -981,7 +1242,7 @@ ebbrt::NetworkManager::TcpEntry::Output(ebbrt::clock::Wall::time_point now) {
     unacked_segments.splice(unacked_segments.end(), std::move(pending_segments),
                             pending_segments.begin(), it, sent);
   } else {
-    if (!pending_segments.empty() && unacked_segments.empty()) {
+    if (!paced && !pending_segments.empty() && unacked_segments.empty()) {
       // If we have no outstanding segments to be acked and there is at least
       // one segment pending, we need either:
       if (snd_wnd > 0) {
@@ -1029,6 +1290,7 @@ void ebbrt::NetworkManager::TcpEntry::SendEmptyAck() {
   pinfo.csum_start = 0;
   pinfo.csum_offset = 16;  // checksum is 16 bytes into the TCP header
 
+  net_stats->Local().tcp_tx++;
   network_manager->SendIp(std::move(buf), address, std::get<0>(key),
                           kIpProtoTCP, pinfo);
 }
@@ -1093,16 +1355,67 @@ void ebbrt::NetworkManager::TcpEntry::SendSegment(TcpSegment& segment) {
   pinfo.csum_start = 0;
   pinfo.csum_offset = 16;  // checksum is 16 bytes into the TCP header
 
-  // XXX: Actually store the MSS instead of making this assumption
-  size_t mss = 1460;
+  // Segments larger than the negotiated MSS are cut into MSS sized frames by
+  // the device, anything smaller goes out as a single frame
   if (segment.tcp_len > mss) {
     pinfo.gso_type = PacketInfo::kGsoTcpv4;
     pinfo.hdr_len = segment.th.HdrLen();
     pinfo.gso_size = mss;
   }
 
-  network_manager->SendIp(CreateRefChain(*(segment.buf)), address,
-                          std::get<0>(key), kIpProtoTCP, std::move(pinfo));
+  auto& stats = net_stats->Local();
+  stats.tcp_tx++;
+  if (segment.retransmitted)
+    stats.tcp_retransmits++;
+
+  auto buf = likely(!loopback) ? CreateRefChain(*(segment.buf))
+                               : ShareSegment(segment);
+  network_manager->SendIp(std::move(buf), address, std::get<0>(key),
+                          kIpProtoTCP, std::move(pinfo));
+}
+
+// A segment sent over loopback is handed straight to the receiving connection,
+// which may hold on to the payload long after we have freed the segment on
+// its acknowledgement. So rather than lending out references as we do to a
+// device, payload we own is moved into shared buffers the first time the
+// segment is sent, and the receiver gets its own views of them. Payload we
+// only borrow (e.g. zero copy application memory) must not be written by the
+// receiver nor outlive the acknowledgement, so it stays in the segment and is
+// copied on each transmission. The header is copied as we rewrite it on every
+// (re)transmission.
+std::unique_ptr<ebbrt::MutIOBuf>
+ebbrt::NetworkManager::TcpEntry::ShareSegment(TcpSegment& segment) {
+  if (!segment.shared) {
+    auto rest = segment.buf->Pop();
+    while (rest) {
+      auto next = rest->Pop();
+      if (dynamic_cast<MutIOBuf*>(rest.get())) {
+        rest = IOBuf::Create<MutSharedIOBufRef>(SharedIOBufRef::CloneView,
+                                                std::move(rest));
+      }
+      segment.buf->PrependChain(std::move(rest));
+      rest = std::move(next);
+    }
+    segment.shared = true;
+  }
+
+  auto hdr_len = segment.buf->Length();
+  auto buf = MakeUniqueIOBuf(hdr_len + sizeof(Ipv4Header));
+  buf->Advance(sizeof(Ipv4Header));
+  std::memcpy(buf->MutData(), segment.buf->Data(), hdr_len);
+  // walked as IOBufs, borrowed payload need not be a MutIOBuf
+  const IOBuf& head = *segment.buf;
+  for (auto b = head.Next(); b != &head; b = b->Next()) {
+    if (auto shared = dynamic_cast<const MutSharedIOBufRef*>(b)) {
+      buf->PrependChain(IOBuf::Create<MutSharedIOBufRef>(
+          SharedIOBufRef::CloneView, *shared));
+    } else {
+      auto copy = MakeUniqueIOBuf(b->Length());
+      std::memcpy(copy->MutData(), b->Data(), b->Length());
+      buf->PrependChain(std::move(copy));
+    }
+  }
+  return std::move(buf);
 }
 
 // Send a reset packet
@@ -1134,5 +1447,8 @@ void ebbrt::NetworkManager::TcpReset(bool ack, uint32_t seqno, uint32_t ackno,
   pinfo.csum_start = 0;  // 14 byte eth header + 20 byte ip header
   pinfo.csum_offset = 16;  // checksum is 16 bytes into the TCP header
 
+  auto& stats = net_stats->Local();
+  stats.tcp_tx++;
+  stats.tcp_rst_tx++;
   SendIp(std::move(buf), local_ip, remote_ip, kIpProtoTCP, pinfo);
 }
@@ -7,6 +7,8 @@
 
 namespace ebbrt {
 const constexpr size_t kTcpMss = 1460;
+// RFC 1122 4.2.2.6: the MSS to assume when the peer does not send the option
+const constexpr size_t kTcpDefaultMss = 536;
 const constexpr uint32_t kTcpWnd = 1 << 21;
 const constexpr uint8_t kWindowShift = 7;
 
@@ -25,6 +27,11 @@ const constexpr uint16_t kTcpCwr = 0x80;
 
 const constexpr uint16_t kTcpFlagMask = 0x3f;
 
+const constexpr uint8_t kTcpOptEnd = 0;
+const constexpr uint8_t kTcpOptNop = 1;
+const constexpr uint8_t kTcpOptMss = 2;
+const constexpr uint8_t kTcpOptWs = 3;
+
 struct __attribute__((packed)) TcpHeader {
   void SetHdrLenFlags(size_t header_len, uint16_t flags) {
     auto header_words = header_len / 4;
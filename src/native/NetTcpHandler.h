@@ -32,7 +32,8 @@ class TcpHandler : public ebbrt::NetworkManager::ITcpHandler {
   // Callback to be invoked when the remote receive window has increased.
   void SendWindowIncrease() override {
     // Send any enqueued data
-    Send(std::move(buf_));
+    if (buf_)
+      Send(std::move(buf_));
     if (!buf_) {
       // Disable this callback
       pcb_.SetWindowNotify(false);
@@ -0,0 +1,70 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "NetTcpPacer.h"
+
+const constexpr ebbrt::EbbId ebbrt::TcpPacer::static_id;
+
+// Register a connection to be released at departure. A connection is held at
+// most once, so rescheduling replaces any earlier registration.
+void ebbrt::TcpPacer::Schedule(NetworkManager::TcpEntry& entry,
+                               ebbrt::clock::Wall::time_point departure) {
+  if (entry.pacing_hook.is_linked())
+    entries_.erase(entries_.iterator_to(entry));
+
+  entry.pacing_release = departure;
+  entries_.insert(entry);
+  Arm(ebbrt::clock::Wall::Now());
+}
+
+// Remove a connection from the schedule (e.g. when it is being destroyed)
+void ebbrt::TcpPacer::Cancel(NetworkManager::TcpEntry& entry) {
+  if (!entry.pacing_hook.is_linked())
+    return;
+
+  entries_.erase(entries_.iterator_to(entry));
+  if (entries_.empty() && timer_set_) {
+    timer->Stop(*this);
+    timer_set_ = false;
+  }
+}
+
+// Release every connection whose departure time has passed, in time order
+void ebbrt::TcpPacer::Fire() {
+  timer_set_ = false;
+  auto now = ebbrt::clock::Wall::Now();
+  while (!entries_.empty() && entries_.begin()->pacing_release <= now) {
+    auto& entry = *entries_.begin();
+    entries_.erase(entries_.begin());
+    // Output() may put the entry back on the schedule for its next segment
+    entry.Output(now);
+    entry.SetTimer(now);
+  }
+  Arm(now);
+}
+
+// Make sure the timer will fire for the earliest scheduled departure
+void ebbrt::TcpPacer::Arm(ebbrt::clock::Wall::time_point now) {
+  if (entries_.empty())
+    return;
+
+  auto earliest = entries_.begin()->pacing_release;
+  if (timer_set_) {
+    if (armed_ <= earliest)
+      return;
+    timer->Stop(*this);
+    timer_set_ = false;
+  }
+
+  auto duration = std::chrono::microseconds::zero();
+  if (earliest > now) {
+    // round up so we never fire before the departure time
+    duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                   earliest - now) +
+               std::chrono::microseconds(1);
+  }
+  timer->Start(*this, duration, /* repeat = */ false);
+  armed_ = earliest;
+  timer_set_ = true;
+}
@@ -0,0 +1,57 @@
+//          Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef BAREMETAL_SRC_INCLUDE_EBBRT_NETTCPPACER_H_
+#define BAREMETAL_SRC_INCLUDE_EBBRT_NETTCPPACER_H_
+
+#include <boost/intrusive/set.hpp>
+
+#include "../MulticoreEbbStatic.h"
+#include "../Timer.h"
+#include "Net.h"
+#include "StaticIds.h"
+
+namespace ebbrt {
+// Per-core earliest-departure-time scheduler for paced tcp connections. A
+// connection whose next segment is not yet due registers itself here with the
+// segment's departure time. Connections are released in departure order from
+// a single core-local timer, at which point the connection transmits whatever
+// has become due.
+class TcpPacer : public MulticoreEbbStatic<TcpPacer>, public Timer::Hook {
+ public:
+  static void ClassInit() {}  // no class wide static initialization logic
+
+  static const constexpr EbbId static_id = kTcpPacerId;
+
+  void Schedule(NetworkManager::TcpEntry& entry,
+                ebbrt::clock::Wall::time_point departure);
+  void Cancel(NetworkManager::TcpEntry& entry);
+  void Fire() override;
+
+ private:
+  struct DepartureCompare {
+    bool operator()(const NetworkManager::TcpEntry& lhs,
+                    const NetworkManager::TcpEntry& rhs) const {
+      return lhs.pacing_release < rhs.pacing_release;
+    }
+  };
+
+  typedef boost::intrusive::member_hook<
+      NetworkManager::TcpEntry, boost::intrusive::set_member_hook<>,
+      &NetworkManager::TcpEntry::pacing_hook>
+      PacingHookOption;
+
+  void Arm(ebbrt::clock::Wall::time_point now);
+
+  boost::intrusive::multiset<NetworkManager::TcpEntry, PacingHookOption,
+                             boost::intrusive::compare<DepartureCompare>>
+      entries_;
+  ebbrt::clock::Wall::time_point armed_;
+  bool timer_set_{false};
+};
+
+constexpr auto tcp_pacer = EbbRef<TcpPacer>(TcpPacer::static_id);
+}  // namespace ebbrt
+
+#endif  // BAREMETAL_SRC_INCLUDE_EBBRT_NETTCPPACER_H_
@@ -6,13 +6,16 @@
 
 #include "../UniqueIOBuf.h"
 #include "NetChecksum.h"
+#include "NetRaw.h"
+#include "NetStats.h"
 #include "NetUdp.h"
 
 // Close a listening connection. Note that Receive could still be called until
 // the future is fulfilled
 ebbrt::Future<void> ebbrt::NetworkManager::UdpPcb::Close() {
   if (entry_->port) {
-    network_manager->udp_port_allocator_->Free(entry_->port);
+    if (entry_->port >= 49152)
+      network_manager->udp_ports_.Free(entry_->port);
     std::lock_guard<ebbrt::SpinLock> guard(network_manager->udp_write_lock_);
     network_manager->udp_pcbs_.erase(*entry_);
     entry_->port = 0;
@@ -31,12 +34,12 @@ void ebbrt::NetworkManager::UdpPcb::UdpEntryDeleter::operator()(UdpEntry* e) {
 // port
 uint16_t ebbrt::NetworkManager::UdpPcb::Bind(uint16_t port) {
   if (!port) {
-    auto ret = network_manager->udp_port_allocator_->Allocate();
+    auto ret = network_manager->udp_ports_.Allocate();
     if (!ret)
       throw std::runtime_error("Failed to allocate ephemeral port");
 
     port = *ret;
-  } else if (port >= 49162 &&
+  } else if (port >= 49152 &&
              !network_manager->udp_port_allocator_->Reserve(port)) {
     throw std::runtime_error("Failed to reserve specified port");
   }
@@ -59,6 +62,8 @@ void ebbrt::NetworkManager::UdpPcb::Receive(
 // Receive UDP packet on an interface
 void ebbrt::NetworkManager::Interface::ReceiveUdp(
     Ipv4Header& ip_header, std::unique_ptr<MutIOBuf> buf) {
+  auto& stats = net_stats->Local();
+  stats.udp_rx++;
   auto packet_len = buf->ComputeChainDataLength();
 
   // Ensure we have a header
@@ -80,10 +85,23 @@ void ebbrt::NetworkManager::Interface::ReceiveUdp(
   //     IpPseudoCsum(*buf, ip_header.proto, ip_header.src, ip_header.dst))
   //   return;
 
+  // Raw bindings see the whole frame. Loopback packets carry no link layer
+  // header, so they only go to UdpPcbs.
+  if (!loopback_) {
+    auto raw = network_manager->raw_udp_ports_.find(ntohs(udp_header.dst_port));
+    if (raw) {
+      buf->Retreat(ip_header.HeaderLength() + sizeof(EthernetHeader));
+      EbbRef<RawPacket>(raw->id)->Deliver(std::move(buf));
+      return;
+    }
+  }
+
   auto entry = network_manager->udp_pcbs_.find(ntohs(udp_header.dst_port));
 
-  if (!entry)
+  if (!entry) {
+    stats.udp_no_port++;
     return;
+  }
 
   buf->Advance(sizeof(UdpHeader));
 
@@ -149,12 +167,12 @@ void ebbrt::NetworkManager::Interface::SendUdp(UdpPcb& pcb, Ipv4Address addr,
   pinfo.csum_start = 0;
   pinfo.csum_offset = 6;
 
-  // XXX: Actually get the MTU size, and figure this out
-  size_t max_data_length = 1460;
+  size_t max_data_length = Mtu() - sizeof(Ipv4Header) - sizeof(UdpHeader);
   if (data_size > max_data_length) {
     pinfo.gso_type = PacketInfo::kGsoUdp;
     pinfo.hdr_len = 8;
     pinfo.gso_size = max_data_length;
   }
+  net_stats->Local().udp_tx++;
   SendIp(std::move(header_buf), src_addr, addr, kIpProtoUDP, std::move(pinfo));
 }
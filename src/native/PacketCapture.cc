@@ -0,0 +1,193 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#include "PacketCapture.h"
+
+#include <cstring>
+
+#include "../UniqueIOBuf.h"
+#include "Clock.h"
+#include "EventManager.h"
+#include "Messenger.h"
+#include "Net.h"
+
+EBBRT_PUBLISH_TYPE(ebbrt, PacketCapture);
+
+std::atomic<bool> ebbrt::PacketCapture::enabled_{false};
+
+void ebbrt::PacketCapture::Start(const CaptureFilter& filter) {
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  // Rings are never freed once allocated, as a core may still be capturing
+  // into one after capture has been turned off
+  for (size_t i = 0; i < Cpu::Count(); ++i) {
+    if (!rings_[i].slots)
+      rings_[i].slots.reset(new uint8_t[kRingSize * kSlotSize]);
+  }
+  auto config = new Config();
+  config->filter = filter;
+  config->snap_len = filter.snap_len && filter.snap_len < pcap::kMaxSnapLen
+                         ? filter.snap_len
+                         : pcap::kMaxSnapLen;
+  // capture may already be on, cores still using the old filter are done
+  // with it after a grace period
+  auto old = config_.exchange(config, std::memory_order_release);
+  if (old)
+    event_manager->DoRcu([old]() { delete old; });
+  enabled_.store(true, std::memory_order_release);
+}
+
+void ebbrt::PacketCapture::Stop() {
+  enabled_.store(false, std::memory_order_relaxed);
+}
+
+// Does the captured packet p (which starts with its Ethernet header) pass the
+// filter? Only the captured bytes are inspected, so a snap length shorter than
+// the headers matched on will cause packets to be missed.
+bool ebbrt::PacketCapture::Match(const CaptureFilter& f, const uint8_t* p,
+                                 size_t len) {
+  bool match_l4 = f.src_port || f.dst_port || f.tcp_flags;
+  if (!match_l4 && !f.src_addr && !f.dst_addr && !f.proto)
+    return true;
+
+  if (len < sizeof(EthernetHeader) + sizeof(Ipv4Header))
+    return false;
+  const auto& eh = *reinterpret_cast<const EthernetHeader*>(p);
+  if (ntohs(eh.type) != kEthTypeIp)
+    return false;
+  const auto& ih =
+      *reinterpret_cast<const Ipv4Header*>(p + sizeof(EthernetHeader));
+  if ((f.src_addr && ih.src.toU32() != f.src_addr) ||
+      (f.dst_addr && ih.dst.toU32() != f.dst_addr) ||
+      (f.proto && ih.proto != f.proto))
+    return false;
+  if (!match_l4)
+    return true;
+
+  // TCP and UDP headers both begin with the source and destination ports
+  if (ih.proto != kIpProtoTCP && ih.proto != kIpProtoUDP)
+    return false;
+  auto l4 = p + sizeof(EthernetHeader) + ih.HeaderLength();
+  if (l4 + 2 * sizeof(uint16_t) > p + len)
+    return false;
+  auto ports = reinterpret_cast<const uint16_t*>(l4);
+  if ((f.src_port && ntohs(ports[0]) != f.src_port) ||
+      (f.dst_port && ntohs(ports[1]) != f.dst_port))
+    return false;
+  if (f.tcp_flags) {
+    if (ih.proto != kIpProtoTCP || l4 + sizeof(TcpHeader) > p + len)
+      return false;
+    const auto& th = *reinterpret_cast<const TcpHeader*>(l4);
+    if (!(th.Flags() & f.tcp_flags))
+      return false;
+  }
+  return true;
+}
+
+void ebbrt::PacketCapture::Capture(const IOBuf& buf, uint8_t direction) {
+  auto config = config_.load(std::memory_order_acquire);
+  if (!config)
+    return;
+  const auto& filter = config->filter;
+  if (filter.direction && !(filter.direction & direction))
+    return;
+
+  auto& ring = rings_[Cpu::GetMine()];
+  auto head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) == kRingSize) {
+    ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    return;
+  }
+
+  auto slot = ring.slots.get() + (head % kRingSize) * kSlotSize;
+  auto data = slot + sizeof(pcap::RecordHeader);
+  auto len = buf.ComputeChainDataLength();
+  size_t cap_len = std::min<size_t>(len, config->snap_len);
+  size_t copied = 0;
+  for (auto& b : buf) {
+    if (copied == cap_len)
+      break;
+    auto n = std::min(b.Length(), cap_len - copied);
+    std::memcpy(data + copied, b.Data(), n);
+    copied += n;
+  }
+  if (!Match(filter, data, cap_len))
+    return;
+
+  auto& record = *reinterpret_cast<pcap::RecordHeader*>(slot);
+  auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                 clock::Wall::Now().time_since_epoch())
+                 .count();
+  record.ts_sec = now / 1000000;
+  record.ts_usec = now % 1000000;
+  record.incl_len = cap_len;
+  record.orig_len = len;
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+size_t ebbrt::PacketCapture::Drain(uint8_t* out, size_t max_records,
+                                   size_t* len) {
+  std::lock_guard<ebbrt::SpinLock> guard(lock_);
+  size_t count = 0;
+  *len = 0;
+  for (size_t i = 0; i < Cpu::Count() && count < max_records; ++i) {
+    auto& ring = rings_[i];
+    if (!ring.slots)
+      continue;
+    auto tail = ring.tail.load(std::memory_order_relaxed);
+    auto head = ring.head.load(std::memory_order_acquire);
+    for (; tail != head && count < max_records; ++tail, ++count) {
+      auto slot = ring.slots.get() + (tail % kRingSize) * kSlotSize;
+      auto record_len = sizeof(pcap::RecordHeader) +
+                        reinterpret_cast<pcap::RecordHeader*>(slot)->incl_len;
+      std::memcpy(out + *len, slot, record_len);
+      *len += record_len;
+    }
+    ring.tail.store(tail, std::memory_order_release);
+  }
+  return count;
+}
+
+uint64_t ebbrt::PacketCapture::Dropped() const {
+  uint64_t dropped = 0;
+  for (size_t i = 0; i < Cpu::Count(); ++i)
+    dropped += rings_[i].dropped.load(std::memory_order_relaxed);
+  return dropped;
+}
+
+void ebbrt::PacketCapture::ReceiveMessage(Messenger::NetworkId nid,
+                                          std::unique_ptr<IOBuf>&& buf) {
+  if (buf->ComputeChainDataLength() < sizeof(CaptureRequest))
+    return;
+
+  auto dp = buf->GetDataPointer();
+  const auto& request = dp.Get<CaptureRequest>();
+  auto max_len = sizeof(CaptureReply);
+  if (request.op == CaptureRequest::kDrain)
+    max_len += kDrainBatch * kSlotSize;
+  auto reply_buf = MakeUniqueIOBuf(max_len);
+  auto& reply = *reinterpret_cast<CaptureReply*>(reply_buf->MutData());
+  reply.id = request.id;
+  reply.count = 0;
+
+  switch (request.op) {
+  case CaptureRequest::kStart:
+    Start(request.filter);
+    break;
+  case CaptureRequest::kStop:
+    Stop();
+    break;
+  case CaptureRequest::kDrain: {
+    size_t len;
+    reply.count = Drain(reply_buf->MutData() + sizeof(CaptureReply),
+                        kDrainBatch, &len);
+    reply_buf->TrimEnd(max_len - sizeof(CaptureReply) - len);
+    break;
+  }
+  }
+  reply.dropped = Dropped();
+  auto config = config_.load(std::memory_order_acquire);
+  reply.snap_len = config ? config->snap_len : pcap::kMaxSnapLen;
+  SendMessage(nid, std::move(reply_buf));
+}
@@ -0,0 +1,83 @@
+//          Copyright Boston University SESA Group 2013 - 2016.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef BAREMETAL_SRC_INCLUDE_EBBRT_PACKETCAPTURE_H_
+#define BAREMETAL_SRC_INCLUDE_EBBRT_PACKETCAPTURE_H_
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include "../CacheAligned.h"
+#include "../Message.h"
+#include "../Pcap.h"
+#include "../SpinLock.h"
+#include "../StaticSharedEbb.h"
+#include "Cpu.h"
+#include "EbbRef.h"
+#include "StaticIds.h"
+
+namespace ebbrt {
+// Records packets as they are received by and sent from the network
+// interface. Each core appends to its own ring, already in pcap record
+// format, and a full ring drops new packets rather than stalling the stack.
+// The rings are emptied by Drain, typically on behalf of a hosted frontend
+// which writes them out as a pcap file. When capture is off the hooks in the
+// stack cost a single branch on Enabled().
+class PacketCapture : public StaticSharedEbb<PacketCapture>,
+                      public CacheAligned,
+                      public Messagable<PacketCapture> {
+ public:
+  static const constexpr size_t kRingSize = 512;  // records per core
+  static const constexpr size_t kDrainBatch = 256;  // records per message
+
+  static void ClassInit() {}  // no class wide static initialization logic
+
+  PacketCapture() : Messagable<PacketCapture>(kPacketCaptureId) {}
+
+  static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  void Start(const CaptureFilter& filter);
+  void Stop();
+  // direction is CaptureFilter::kRx or CaptureFilter::kTx
+  void Capture(const IOBuf& buf, uint8_t direction);
+  // Copy out and release up to max_records captured records. Returns the
+  // number of records copied and stores the number of bytes in len.
+  size_t Drain(uint8_t* out, size_t max_records, size_t* len);
+
+  void ReceiveMessage(Messenger::NetworkId nid, std::unique_ptr<IOBuf>&& buf);
+
+ private:
+  static const constexpr size_t kSlotSize =
+      (sizeof(pcap::RecordHeader) + pcap::kMaxSnapLen + 7) & ~7;
+
+  // Single producer (the owning core), single consumer (Drain) ring
+  struct alignas(cache_size) Ring {
+    std::unique_ptr<uint8_t[]> slots;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+  };
+
+  // Replaced as a whole by Start and freed after an RCU grace period, so a
+  // core capturing a packet sees one consistent filter
+  struct Config {
+    CaptureFilter filter;
+    uint16_t snap_len;
+  };
+
+  static bool Match(const CaptureFilter& f, const uint8_t* p, size_t len);
+  uint64_t Dropped() const;
+
+  static std::atomic<bool> enabled_;
+
+  std::atomic<const Config*> config_{nullptr};
+  std::array<Ring, Cpu::kMaxCpus> rings_;
+  ebbrt::SpinLock lock_;
+};
+
+constexpr auto packet_capture = EbbRef<PacketCapture>(kPacketCaptureId);
+}  // namespace ebbrt
+
+#endif  // BAREMETAL_SRC_INCLUDE_EBBRT_PACKETCAPTURE_H_
@@ -41,6 +41,19 @@ class SharedPoolAllocator : public SharedEbb<SharedPoolAllocator<T>>,
     return boost::optional<T>(ret);
   }
 
+  // Allocate up to n values under a single acquisition of the lock, returns
+  // the number stored in out
+  size_t AllocateBatch(T* out, size_t n) {
+    std::lock_guard<ebbrt::SpinLock> guard(lock_);
+    size_t count = 0;
+    while (count < n && !set_.empty()) {
+      auto val = boost::icl::lower(set_);
+      set_ -= val;
+      out[count++] = val;
+    }
+    return count;
+  }
+
   bool Reserve(const T& val) {
     std::lock_guard<ebbrt::SpinLock> guard(lock_);
     if (boost::icl::contains(set_, val)) {
@@ -55,6 +68,12 @@ class SharedPoolAllocator : public SharedEbb<SharedPoolAllocator<T>>,
     set_ += val;
   }
 
+  void FreeBatch(const T* vals, size_t n) {
+    std::lock_guard<ebbrt::SpinLock> guard(lock_);
+    for (size_t i = 0; i < n; ++i)
+      set_ += vals[i];
+  }
+
  private:
   ebbrt::SpinLock lock_;
   boost::icl::interval_set<T> set_;
@@ -19,6 +19,7 @@ enum : EbbId {
   kTimerId,
   kNetworkManagerId,
   kMessengerId,
+  kTcpPacerId,
   kFirstFreeId
 };
 
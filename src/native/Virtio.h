@@ -59,7 +59,8 @@ template <typename VirtType> class VirtioDriver {
    public:
     VRing(VirtioDriver<VirtType>& driver, uint16_t qsize, size_t idx, Nid nid)
         : driver_(driver), idx_(idx), qsize_(qsize), last_used_(0),
-          avail_idx_(0), used_head_(0), free_head_(0), free_count_(qsize_),
+          avail_idx_(0), notified_idx_(0), used_head_(0), free_head_(0),
+          free_count_(qsize_), free_next_(qsize_), chains_(qsize_),
           buf_references_(qsize_), event_indexes_(false) {
       auto sz =
           align::Up(sizeof(Desc) * qsize + sizeof(uint16_t) * (3 + qsize),
@@ -86,9 +87,9 @@ template <typename VirtType> class VirtioDriver {
           reinterpret_cast<volatile std::atomic<uint16_t>*>(used_ring_end);
 
       for (unsigned i = 0; i < qsize_; ++i)
-        desc_[i].next = i + 1;
+        free_next_[i] = i + 1;
 
-      desc_[qsize_ - 1].next = 0;
+      free_next_[qsize_ - 1] = 0;
     }
 
     void* addr() { return addr_; }
@@ -100,8 +101,8 @@ template <typename VirtType> class VirtioDriver {
       if (begin == end)
         return end;
       auto count = 0;
-      // auto orig_idx = avail_->idx.load(std::memory_order_relaxed);
-      auto orig_idx = avail_idx_;
+      // include any chains posted earlier without a kick
+      auto orig_idx = notified_idx_;
       for (auto it = begin; it < end; ++it) {
         ++count;
         auto& buf_chain = *it;
@@ -119,12 +120,15 @@ template <typename VirtType> class VirtioDriver {
           auto& desc = desc_[free_head_];
           desc.addr = reinterpret_cast<uint64_t>(buf.Data());
           desc.len = static_cast<uint32_t>(buf.Length());
-          desc.flags |= Desc::Write | Desc::Next;
+          desc.flags = Desc::Write | Desc::Next;
+          desc.next = free_next_[free_head_];
           last_desc = free_head_;
-          free_head_ = desc.next;
+          free_head_ = free_next_[free_head_];
         }
         // make sure the last descriptor is marked as such
-        desc_[last_desc].flags &= ~Desc::Next;
+        desc_[last_desc].flags = Desc::Write;
+        chains_[head].len = chain_len;
+        chains_[head].last = last_desc;
 
         // add this descriptor chain to the avail ring
         avail_->ring[avail_idx_ % qsize_] = head;
@@ -141,6 +145,7 @@ template <typename VirtType> class VirtioDriver {
       // give the device ownership of the added descriptor chains
       // note this need not have any memory ordering due to the preceding fence
       avail_->idx.store(avail_idx_, std::memory_order_relaxed);
+      notified_idx_ = avail_idx_;
 
       // ensure that the previous write is seen before we detect if we must
       // notify the device. This ordering is to guarantee that the following
@@ -161,7 +166,11 @@ template <typename VirtType> class VirtioDriver {
       return end;
     }
 
-    void AddBuffer(std::unique_ptr<IOBuf> bufs, size_t out_num) {
+    // Post a descriptor chain. When kick is false the chain is made available
+    // but the notification check is deferred to the next AddBuffer that does
+    // kick, so a burst of chains costs at most one notification.
+    void AddBuffer(std::unique_ptr<IOBuf> bufs, size_t out_num,
+                   bool kick = true) {
       auto len = bufs->CountChainElements();
       kassert(free_count_ >= len);
 
@@ -174,19 +183,21 @@ template <typename VirtType> class VirtioDriver {
         auto& desc = desc_[free_head_];
         desc.addr = reinterpret_cast<uint64_t>(addr);
         desc.len = size;
-        desc.flags |= Desc::Next;
+        uint16_t flags = Desc::Next;
         if (out_num == 0) {
-          desc.flags |= Desc::Write;
+          flags |= Desc::Write;
         } else {
           --out_num;
         }
+        desc.flags = flags;
+        desc.next = free_next_[free_head_];
         last_desc = free_head_;
-        free_head_ = desc.next;
+        free_head_ = free_next_[free_head_];
       }
       desc_[last_desc].flags &= ~Desc::Next;
+      chains_[head].len = len;
+      chains_[head].last = last_desc;
 
-      // auto avail_idx = avail_->idx.load(std::memory_order_relaxed);
-      auto orig_idx = avail_idx_;
       avail_->ring[avail_idx_ % qsize_] = head;
       ++avail_idx_;
 
@@ -194,6 +205,15 @@ template <typename VirtType> class VirtioDriver {
 
       avail_->idx.store(avail_idx_, std::memory_order_relaxed);
 
+      kassert(head < qsize_);
+      buf_references_[head] = std::move(bufs);
+
+      if (!kick)
+        return;
+
+      auto orig_idx = notified_idx_;
+      notified_idx_ = avail_idx_;
+
       std::atomic_thread_fence(std::memory_order_seq_cst);
 
       if (event_indexes_) {
@@ -206,9 +226,6 @@ template <typename VirtType> class VirtioDriver {
                    Used::kNoNotify)) {
         Kick();
       }
-
-      kassert(head < qsize_);
-      buf_references_[head] = std::move(bufs);
     }
 
     bool HasUsedBuffer() {
@@ -225,15 +242,7 @@ template <typename VirtType> class VirtioDriver {
       kassert(buf_references_[elem.id]);
       // This const cast is needed to trim the buffer chain
       auto buf = std::move(buf_references_[elem.id]);
-      Desc* descriptor = &desc_[elem.id];
-      auto len = 1;
-      while (descriptor->flags & Desc::Next) {
-        ++len;
-        descriptor = &desc_[descriptor->next];
-      }
-      descriptor->next = free_head_;
-      free_head_ = elem.id;
-      free_count_ += len;
+      FreeChain(elem.id);
       ++last_used_;
 
       // trim the buffer chain to only include the actual size
@@ -259,15 +268,7 @@ template <typename VirtType> class VirtioDriver {
         auto& elem = used_->ring[last_used_ % qsize_];
         kassert(buf_references_[elem.id]);
         buf_references_[elem.id].reset();
-        Desc* descriptor = &desc_[elem.id];
-        auto len = 1;
-        while (descriptor->flags & Desc::Next) {
-          ++len;
-          descriptor = &desc_[descriptor->next];
-        }
-        descriptor->next = free_head_;
-        free_head_ = elem.id;
-        free_count_ += len;
+        FreeChain(elem.id);
         ++last_used_;
       }
     }
@@ -278,15 +279,7 @@ template <typename VirtType> class VirtioDriver {
         auto& elem = used_->ring[last_used_ % qsize_];
         kassert(buf_references_[elem.id]);
         auto& buf = buf_references_[elem.id];
-        Desc* descriptor = &desc_[elem.id];
-        auto len = 1;
-        while (descriptor->flags & Desc::Next) {
-          ++len;
-          descriptor = &desc_[descriptor->next];
-        }
-        descriptor->next = free_head_;
-        free_head_ = elem.id;
-        free_count_ += len;
+        FreeChain(elem.id);
         ++last_used_;
 
         auto packet_len = elem.len;
@@ -343,6 +336,22 @@ template <typename VirtType> class VirtioDriver {
       uint32_t len;
     };
 
+    // Driver private bookkeeping for a descriptor chain, indexed by its head
+    struct Chain {
+      uint16_t len;
+      uint16_t last;
+    };
+
+    // Return a used descriptor chain to the free list. The free list and the
+    // chain bookkeeping live outside the ring, so reclaiming never reads
+    // descriptors the device has just been working on.
+    void FreeChain(uint16_t head) {
+      const auto& chain = chains_[head];
+      free_next_[chain.last] = free_head_;
+      free_head_ = head;
+      free_count_ += chain.len;
+    }
+
     struct Used {
       static const constexpr uint16_t kNoNotify = 1;
 
@@ -362,9 +371,13 @@ template <typename VirtType> class VirtioDriver {
     uint16_t qsize_;
     uint16_t last_used_;
     uint16_t avail_idx_;
+    // avail_idx_ as of the last notification check
+    uint16_t notified_idx_;
     uint16_t used_head_;
     uint16_t free_head_;
     uint16_t free_count_;
+    std::vector<uint16_t> free_next_;
+    std::vector<Chain> chains_;
     std::vector<std::unique_ptr<IOBuf>> buf_references_;
     bool event_indexes_;
     bool interrupts_;
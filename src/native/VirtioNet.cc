@@ -8,10 +8,12 @@
 #include "../UniqueIOBuf.h"
 #include "Debug.h"
 #include "EventManager.h"
+#include "NetStats.h"
 
 namespace {
 const constexpr uint32_t kCSum = 0;
 const constexpr uint32_t kGuestCSum = 1;
+const constexpr uint32_t kMtu = 3;
 const constexpr uint32_t kMac = 5;
 const constexpr uint32_t kGuestTso4 = 7;
 const constexpr uint32_t kGuestTso6 = 8;
@@ -26,6 +28,11 @@ const constexpr uint32_t kCtrlVq = 17;
 const constexpr uint32_t kMq = 22;
 const constexpr uint32_t kNotifyOnEmpty = 24;
 
+// Offsets into the device specific configuration space
+const constexpr size_t kConfigMac = 0;
+const constexpr size_t kConfigMaxQueuePairs = 8;
+const constexpr size_t kConfigMtu = 10;
+
 const constexpr uint8_t kVirtioNetCtrlMq = 4;
 const constexpr uint8_t kVirtioNetCtrlMqVqPairsSet = 0;
 
@@ -66,8 +73,16 @@ ebbrt::VirtioNetDriver::VirtioNetDriver(pci::Device& dev)
   auto tso4 = features & (1 << kHostTso4);
   kbugon(!tso4, "Device missing tcp segmentation offload support\n");
 
+  // If the device advertises its MTU (e.g. jumbo frames were configured on
+  // the host) use it, otherwise assume standard ethernet
+  if (features & (1 << kMtu)) {
+    mtu_ = DeviceConfigRead16(kConfigMtu);
+    kbugon(mtu_ < kEthMinMtu, "Device reported invalid MTU\n");
+  }
+  kprintf("MTU: %d\n", mtu_);
+
   // Figure out max queue pairs supported
-  auto max_queue_pairs = DeviceConfigRead16(8);
+  auto max_queue_pairs = DeviceConfigRead16(kConfigMaxQueuePairs);
   auto num_cores = Cpu::Count();
   // We map a queue pair to each core, so assert that there are enough
   kassert(max_queue_pairs >= num_cores);
@@ -137,7 +152,7 @@ ebbrt::VirtioNetDriver::VirtioNetDriver(pci::Device& dev)
   }
 
   for (int i = 0; i < 6; ++i) {
-    mac_addr_[i] = DeviceConfigRead8(i);
+    mac_addr_[i] = DeviceConfigRead8(kConfigMac + i);
   }
 
   kprintf(
@@ -153,9 +168,9 @@ void ebbrt::VirtioNetDriver::Start() {
 }
 
 uint32_t ebbrt::VirtioNetDriver::GetDriverFeatures() {
-  return 1 << kCSum | 1 << kGuestCSum | 1 << kMac | 1 << kGuestTso4 |
-         1 << kGuestUfo | 1 << kHostTso4 | 1 << kHostUfo | 1 << kMrgRxbuf |
-         1 << kCtrlVq | 1 << kMq;
+  return 1 << kCSum | 1 << kGuestCSum | 1 << kMtu | 1 << kMac |
+         1 << kGuestTso4 | 1 << kGuestUfo | 1 << kHostTso4 | 1 << kHostUfo |
+         1 << kMrgRxbuf | 1 << kCtrlVq | 1 << kMq;
 }
 
 ebbrt::VirtioNetRep::VirtioNetRep(const VirtioNetDriver& root)
@@ -196,7 +211,7 @@ void ebbrt::VirtioNetRep::Send(std::unique_ptr<IOBuf> buf, PacketInfo pinfo) {
       data += buf_it.Length();
     }
   } else {
-    kprintf("Drop\n");
+    net_stats->Local().tx_drops++;
     // kick to make it process more buffers, drop the send
     snd_queue_.Kick();
     return;
@@ -213,14 +228,20 @@ void ebbrt::VirtioNetRep::Send(std::unique_ptr<IOBuf> buf, PacketInfo pinfo) {
     header->hdr_len = pinfo.hdr_len;
     header->gso_size = pinfo.gso_size;
   }
+  auto& stats = net_stats->Local();
+  stats.tx_packets++;
+  stats.tx_bytes += b->ComputeChainDataLength() - sizeof(VirtioNetHeader);
   auto elements = b->CountChainElements();
-  snd_queue_.AddBuffer(std::move(b), elements);
+  snd_queue_.AddBuffer(std::move(b), elements,
+                       !(pinfo.flags & PacketInfo::kMore));
 }
 
 const ebbrt::EthernetAddress& ebbrt::VirtioNetDriver::GetMacAddress() {
   return mac_addr_;
 }
 
+uint16_t ebbrt::VirtioNetDriver::GetMtu() { return mtu_; }
+
 void ebbrt::VirtioNetRep::Receive() {
   rcv_queue_.DisableInterrupts();
   receive_callback_.Start();
@@ -234,8 +255,11 @@ process:
     circ_buffer_[circ_buffer_head_ % 256] = std::move(buf);
     ++circ_buffer_head_;
     if (circ_buffer_head_ != circ_buffer_tail_ &&
-        (circ_buffer_head_ % 256) == (circ_buffer_tail_ % 256))
+        (circ_buffer_head_ % 256) == (circ_buffer_tail_ % 256)) {
+      // overwrote the oldest packet
       ++circ_buffer_tail_;
+      net_stats->Local().rx_drops++;
+    }
   });
   // If there are no used buffers, turn on interrupts and stop this poll
   if (circ_buffer_head_ == circ_buffer_tail_) {
@@ -270,6 +294,9 @@ process:
 
   // }
   b->Advance(sizeof(VirtioNetHeader));
+  auto& stats = net_stats->Local();
+  stats.rx_packets++;
+  stats.rx_bytes += b->ComputeChainDataLength();
   root_.itf_.Receive(std::move(b));
 }
 
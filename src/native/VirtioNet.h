@@ -25,6 +25,7 @@ class VirtioNetDriver : public VirtioDriver<VirtioNetDriver>,
   static uint32_t GetDriverFeatures();
   void Send(std::unique_ptr<IOBuf> buf, PacketInfo pinfo) override;
   const EthernetAddress& GetMacAddress() override;
+  uint16_t GetMtu() override;
 
  private:
   void FillRxRing();
@@ -34,6 +35,7 @@ class VirtioNetDriver : public VirtioDriver<VirtioNetDriver>,
 
   EbbRef<VirtioNetRep> ebb_;
   EthernetAddress mac_addr_;
+  uint16_t mtu_{kEthDefaultMtu};
   NetworkManager::Interface& itf_;
   VRing* ctrl_queue_;
 